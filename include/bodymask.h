@@ -0,0 +1,186 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <algorithm> //std::min, std::max
+#include <assert.h>
+#include "threads.h" //parallel_for
+
+/*
+ * Patient outline of a density volume: voxels at or above a threshold, minus the couch rows, of which only the largest
+ * 6-connected component is kept, so noise, immobilisation devices and a detached couch fall outside.
+ * Holes are filled per z slice, so lungs and bowel gas are inside even where they connect to the outside through the airways.
+ * Labelling works on runs of voxels along x instead of on voxels: runs are found per z slice in parallel,
+ * then joined with a union-find over overlapping runs of the previous row and slice. There are few runs per row,
+ * so the serial part is small compared to one pass over the volume.
+ */
+
+class BodyMask {
+public:
+	BodyMask(const float*, const std::vector<int> &, float, int = -1, unsigned int = 0); //density, dim_size, threshold (below is outside), first couch row in y (-1: no couch), nthreads
+
+	std::vector<uint8_t> inside; //1 for body voxels
+	size_t count = 0; //nr of body voxels
+	std::vector<int> box_first, box_last; //inclusive bounding box of the body, empty when there is none
+
+	bool empty() const { return count == 0; };
+
+private:
+	struct Run {
+		int x0, x1; //[x0, x1)
+	};
+
+	static int find(std::vector<int> &, int); //union-find, parent per id
+	static void unite(std::vector<int> &, int, int);
+	static size_t fill_slice(std::vector<Run>*, int, int, uint8_t*); //body runs per row of a slice, nx, ny, mask of the slice. returns the nr of body voxels.
+};
+
+
+BodyMask::BodyMask(const float* density, const std::vector<int> &dims, float threshold, int couch_row, unsigned int nthreads){
+	assert(dims.size() == 3);
+	const int nx = dims[0], ny = dims[1], nz = dims[2];
+	const int body_rows = (couch_row < 0) ? ny : std::min(couch_row, ny); //rows at and beyond the couch are never body
+	const size_t nrows = size_t(ny) * nz, slice = size_t(nx) * ny;
+	inside.assign(slice * nz, 0);
+
+	//runs per row (y + ny * z), each z slice on its own
+	std::vector<std::vector<Run>> runs(nrows);
+	threads::parallel_for(nz, [&](size_t z){
+		for (int y = 0; y < body_rows; y++){
+			const float* row = density + z * slice + size_t(y) * nx;
+			std::vector<Run> &r = runs[y + ny * z];
+			for (int x = 0; x < nx; x++){
+				if (!(row[x] >= threshold)) continue;
+				int x0 = x;
+				while (x < nx && row[x] >= threshold) x++;
+				r.push_back({ x0, x });
+			}
+		}
+	}, nthreads);
+
+	//run ids are consecutive in row order
+	std::vector<size_t> first_run(nrows + 1, 0);
+	for (size_t r = 0; r < nrows; r++) first_run[r + 1] = first_run[r] + runs[r].size();
+	std::vector<int> parent(first_run[nrows]);
+	for (size_t i = 0; i < parent.size(); i++) parent[i] = int(i);
+
+	//join overlapping runs of two rows, both sorted in x
+	auto join = [&](size_t a, size_t b){
+		const std::vector<Run> &ra = runs[a], &rb = runs[b];
+		size_t i = 0, j = 0;
+		while (i < ra.size() && j < rb.size()){
+			if (ra[i].x0 < rb[j].x1 && rb[j].x0 < ra[i].x1) unite(parent, int(first_run[a] + i), int(first_run[b] + j));
+			if (ra[i].x1 < rb[j].x1) i++;
+			else j++;
+		}
+	};
+	for (int z = 0; z < nz; z++){
+		for (int y = 0; y < body_rows; y++){
+			size_t r = y + size_t(ny) * z;
+			if (y > 0) join(r, r - 1);
+			if (z > 0) join(r, r - ny);
+		}
+	}
+
+	//largest component, the lowest root wins a tie so the result does not depend on anything but the input
+	if (parent.empty()) return;
+	std::vector<size_t> component_size(parent.size(), 0);
+	for (size_t r = 0; r < nrows; r++){
+		for (size_t i = 0; i < runs[r].size(); i++) component_size[find(parent, int(first_run[r] + i))] += runs[r][i].x1 - runs[r][i].x0;
+	}
+	int body = int(std::max_element(component_size.begin(), component_size.end()) - component_size.begin());
+
+	//keep the runs of the body only
+	box_first = { nx, ny, nz };
+	box_last = { -1, -1, -1 };
+	for (int z = 0; z < nz; z++){
+		for (int y = 0; y < ny; y++){
+			size_t r = y + size_t(ny) * z;
+			size_t kept = 0;
+			for (size_t i = 0; i < runs[r].size(); i++){
+				if (find(parent, int(first_run[r] + i)) == body) runs[r][kept++] = runs[r][i];
+			}
+			runs[r].resize(kept);
+			if (kept == 0) continue;
+			box_first[0] = std::min(box_first[0], runs[r].front().x0);
+			box_last[0] = std::max(box_last[0], runs[r].back().x1 - 1);
+			box_first[1] = std::min(box_first[1], y);
+			box_last[1] = std::max(box_last[1], y);
+			box_first[2] = std::min(box_first[2], z);
+			box_last[2] = std::max(box_last[2], z);
+		}
+	}
+
+	std::vector<size_t> slice_count(nz, 0);
+	threads::parallel_for(box_last[2] - box_first[2] + 1, [&](size_t i){
+		size_t z = box_first[2] + i;
+		slice_count[z] = fill_slice(runs.data() + z * ny, nx, ny, inside.data() + z * slice);
+	}, nthreads);
+	for (size_t c : slice_count) count += c;
+}
+
+
+size_t BodyMask::fill_slice(std::vector<Run>* rows, int nx, int ny, uint8_t* m){
+	//background between body runs of a row is a gap. gaps 4-connected to the edge of the slice, or to the background
+	//before the first or after the last run of a row, are outside. the others are holes in the body and are filled.
+	std::vector<Run> gaps;
+	std::vector<size_t> first_gap(ny + 1, 0);
+	for (int y = 0; y < ny; y++){
+		for (size_t k = 1; k < rows[y].size(); k++) gaps.push_back({ rows[y][k - 1].x1, rows[y][k].x0 });
+		first_gap[y + 1] = gaps.size();
+	}
+	std::vector<int> parent(gaps.size() + 1); //0 is the outside, gap g is g + 1
+	for (size_t i = 0; i < parent.size(); i++) parent[i] = int(i);
+
+	//touches the outside of row y
+	auto open = [&](int y, const Run &g){
+		if (y < 0 || y >= ny || rows[y].empty()) return true;
+		return g.x0 < rows[y].front().x0 || g.x1 > rows[y].back().x1;
+	};
+	for (int y = 0; y < ny; y++){
+		for (size_t g = first_gap[y]; g < first_gap[y + 1]; g++){
+			if (open(y - 1, gaps[g]) || open(y + 1, gaps[g])) unite(parent, 0, int(g + 1));
+		}
+		if (y == 0) continue;
+		size_t i = first_gap[y - 1], j = first_gap[y];
+		while (i < first_gap[y] && j < first_gap[y + 1]){
+			if (gaps[i].x0 < gaps[j].x1 && gaps[j].x0 < gaps[i].x1) unite(parent, int(i + 1), int(j + 1));
+			if (gaps[i].x1 < gaps[j].x1) i++;
+			else j++;
+		}
+	}
+
+	size_t ret = 0;
+	const int outside = find(parent, 0);
+	for (int y = 0; y < ny; y++){
+		uint8_t* row = m + size_t(nx) * y;
+		for (const Run &run : rows[y]){
+			std::fill(row + run.x0, row + run.x1, 1);
+			ret += run.x1 - run.x0;
+		}
+		for (size_t g = first_gap[y]; g < first_gap[y + 1]; g++){
+			if (find(parent, int(g + 1)) == outside) continue;
+			std::fill(row + gaps[g].x0, row + gaps[g].x1, 1);
+			ret += gaps[g].x1 - gaps[g].x0;
+		}
+	}
+	return ret;
+}
+
+
+int BodyMask::find(std::vector<int> &parent, int i){
+	while (parent[i] != i){
+		parent[i] = parent[parent[i]]; //path halving
+		i = parent[i];
+	}
+	return i;
+}
+
+
+void BodyMask::unite(std::vector<int> &parent, int a, int b){
+	a = find(parent, a);
+	b = find(parent, b);
+	if (a == b) return;
+	if (a < b) parent[b] = a; //lowest id is the root
+	else parent[a] = b;
+}
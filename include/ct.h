@@ -2,6 +2,8 @@
 
 #include <istream>
 #include <assert.h>
+#include <map>
+#include <mutex>
 
 #include "pystring.h"
 using namespace pystring;
@@ -9,6 +11,9 @@ using std::string;
 #include "tools.h"
 using namespace vect;
 #include "image.h"
+#include "imagewriter.h"
+#include "phantomcache.h"
+#include "bodymask.h"
 
 #include "Phantom.h"
 #include "settings.h"
@@ -21,6 +26,36 @@ using namespace vect;
 
 class CT;
 
+//raw ct value -> hu -> (mass density, medium index), as configured by hu2dens.ini and dens2mat.ini
+struct HuConversion {
+	float hu_slope = 1.f;
+	float hu_intercept = 0.f;
+	PiecewiseLinear hu2density;
+	PiecewiseLinear density2material; //continuous materials
+	vector<float> material_dens; //integer materials: the last one with a density not above
+	bool continuous = true;
+	string key; //everything the conversion depends on, see CT::conversion_lut()
+
+	void operator()(float raw, float &density, float &medium) const;
+};
+
+
+void HuConversion::operator()(float raw, float &density, float &medium) const {
+	float hu = raw * hu_slope + hu_intercept;
+	density = hu2density(hu);
+	if (density < 0) density = 0.f;
+	if (continuous){
+		//NOTE: indices are continuous: a matindex of 1.4 will be a mix of 40% material 1 and 60% material 2 by weight.
+		medium = density2material(density);
+	}
+	else {
+		//any densities lower than minimum found in file are assumed to be of material at first line.
+		long j = std::upper_bound(material_dens.begin(), material_dens.end(), density) - material_dens.begin() - 1;
+		medium = float(std::max(j, 0L));
+	}
+}
+
+
 class CT{
 public:
 	//members needed by gpumcd
@@ -30,36 +65,72 @@ public:
 	//ctors
 	CT() = default;
 	CT(const CT &) = default;
-	~CT() = default;
+	CT(CT &&) = default;
+	CT &operator=(const CT &) = default;
+	CT &operator=(CT &&) = default;
+	~CT(); //waits for pending_writes, errors are printed as a destructor cannot throw. see flush_output().
 
 	CT(DosiaSettings &, BeamMetaData &);
 
 	//methods
 	int num_vox(){ return image.nvox(); };
-	Image generate_image(const vector<float> &);
+	Image generate_image(const vector<float> &); // on the phantom grid
+	Image generate_image(vector<float> &&); // takes over the voxels
+	Image dose_on_ct_grid(const Image &); // upsample a dose from the phantom grid
+	void flush_output(); // waits for the debug images being written in the background, rethrows the first error. also called on destruction.
 
 private:
 	//members
 	BeamMetaData beamMetaData;
 	DosiaSettings sett;
 	Image image;
+	Image ct_box; //the part of the ct the phantom covers: all of it, unless cropped to the body
+	vector<int> box_first; //voxel of the ct at the first corner of ct_box
+	Image grid; //geometry the phantom is on, ct_box unless dose_grid_voxel_size is set
+	vector<std::shared_future<void>> pending_writes;
 
 	//methods
-	Phantom generate_phantom(const Image &, const string &, const string &);
-	template <typename T>
-	void set_hu2density(const string &, const vector<T> &, vector<float> &);
+	Phantom generate_phantom(const Image &, const HuConversion &);
+	Phantom downsample_phantom(const Phantom &, const Image &, const Image &);
+	void apply_body_mask(Phantom &, const Image &, const HuConversion &); //air outside the patient, crop to it
+	void set_ct_box(const Phantom &); //from the extent of the phantom, also sets grid
+	HuConversion read_conversion(const string &, const string &); //hu2dens, dens2mat. fills materials.
+	static std::shared_ptr<const vector<std::pair<float, float>>> conversion_lut(const HuConversion &);
+	uint64_t phantom_key(const HuConversion &) const; //hash of everything the phantom depends on, see PhantomCache
 	//void set_hu2material(const string & = "hu2mat.ini"); //use with Schneider data from Gate
-	void set_density2material(const string &, const vector<float> &, vector<float> &);
 };
 
 
 CT::CT(DosiaSettings &_sett, BeamMetaData &_beamMetaData) : beamMetaData(_beamMetaData), sett(_sett){
 
 	string &rt_files = sett.rt_files;
-	image = Image(os::path::join(rt_files, "ct.xdr"));
+	image = Image(os::path::join(rt_files, "ct.xdr"), ImageLoad::NATIVE); //keep the shorts, we only need floats for the conversion
 	if (sett.verbose > 1) cerr << "phantom file loaded: " << os::path::join(rt_files, "ct.xdr") << "\n";
 	
-	phantom = generate_phantom(image, os::path::join(sett.hounsfield_conversion_dir, "hu2dens.ini"), os::path::join(sett.hounsfield_conversion_dir, "dens2mat.ini"));
+	const HuConversion conversion = read_conversion(os::path::join(sett.hounsfield_conversion_dir, "hu2dens.ini"), os::path::join(sett.hounsfield_conversion_dir, "dens2mat.ini"));
+
+	//same ct, tables and settings give the same phantom, so take it from the cache if we made it before
+	bool cached = false;
+	uint64_t key = 0;
+	PhantomCache cache(sett.phantom_cache_dir, sett.phantom_cache_bytes);
+	if (!sett.phantom_cache_dir.empty()){
+		key = phantom_key(conversion);
+		cached = cache.load(key, phantom, materials);
+		if (cached && (sett.in_aqua_vivo || sett.score_and_transport_in_water || sett.score_dose_to_water)) {
+			sett.physicsSettings.referenceMedium = materials.size() - 1; //water, as generate_phantom() sets it
+		}
+		if (sett.verbose > 1) cerr << "phantom cache " << (cached ? "hit: " : "miss: ") << cache.path(key) << "\n";
+		if (cached) set_ct_box(phantom); //a cropped phantom knows where it is
+	}
+
+	if (!cached){
+		phantom = generate_phantom(image, conversion);
+		set_ct_box(phantom);
+		if (sett.dose_grid_voxel_size > 0) phantom = downsample_phantom(phantom, ct_box, grid);
+		if (!sett.phantom_cache_dir.empty() && !cache.store(key, phantom, materials)){
+			if (sett.verbose > 0) cerr << "Could not write the phantom cache in " << sett.phantom_cache_dir << ", continuing without.\n";
+		}
+	}
 
 	if (sett.verbose > 1) {
 		fprintf(stderr, "voxelSizes: %.2f,%.2f,%.2f\n", phantom.voxelSizes.x, phantom.voxelSizes.y, phantom.voxelSizes.z);
@@ -68,20 +139,25 @@ CT::CT(DosiaSettings &_sett, BeamMetaData &_beamMetaData) : beamMetaData(_beamMe
 	}
 
 	if (sett.dbgoutput){
-		Image mediumIndex = generate_image(phantom.mediumIndexArray);
-		Image massDensity = generate_image(phantom.massDensityArray);
-		mediumIndex.write(os::path::join(rt_files, "mediumIndex.xdr"));
-		massDensity.write(os::path::join(rt_files, "massDensityArray.xdr"));
+		//written in the background, so disk latency stays off the path to dose computation. see flush_output().
+		//the phantom keeps its arrays, the writer gets copies.
+		AsyncImageWriter &writer = AsyncImageWriter::global();
+		if (sett.continous_materials){
+			pending_writes.push_back(writer.write(generate_image(phantom.mediumIndexArray), os::path::join(rt_files, "mediumIndex.xdr")).share());
+		}
+		else {
+			pending_writes.push_back(writer.write(generate_image(phantom.mediumIndexArray).converted(types::VoxelType::UINT8), os::path::join(rt_files, "mediumIndex.xdr")).share()); //integer indices, write them as bytes
+		}
+		pending_writes.push_back(writer.write(generate_image(phantom.massDensityArray), os::path::join(rt_files, "massDensityArray.xdr")).share());
 	}
 };
 
 
-Phantom CT::generate_phantom(const Image &im, const string &hu2dens_fname, const string &dens2mat_fname){
+Phantom CT::generate_phantom(const Image &im, const HuConversion &conversion){
 	//think of this function as a constructor for Phantom structures
 	assert(im.ndim() == 3);
 
-	Phantom phantom;
-	vector<float> ct_voxels; // gpumcd cares only about floats
+	Phantom phantom; //returned by move (or elided), as are its arrays
 
 	//setup coords,dimensions
 
@@ -103,111 +179,316 @@ Phantom CT::generate_phantom(const Image &im, const string &hu2dens_fname, const
 	phantom.phantomCorner.y -= phantom.voxelSizes.y / 2.;
 	phantom.phantomCorner.z -= phantom.voxelSizes.z / 2.;
 
-	//convert image to HU units
-	ct_voxels.resize(im.nvox());
-	for (int i = 0; i < im.nvox(); i++){
-		ct_voxels[i] = im.imdata[i] * beamMetaData.hu_slope + beamMetaData.hu_intercept;
-	}
-	//convert HU units to mass density and materials.
-	set_hu2density(hu2dens_fname, ct_voxels, phantom.massDensityArray);
-	set_density2material(dens2mat_fname, phantom.massDensityArray, phantom.mediumIndexArray);
-
 	if (sett.in_aqua_vivo || sett.score_and_transport_in_water || sett.score_dose_to_water) {
 		// set ref medium to water
 		materials.push_back("Water"); //preserve existing materials, because GPUMCD still checks presence.
 		sett.physicsSettings.referenceMedium = materials.size() - 1;
 	}
-	if (sett.in_aqua_vivo || sett.score_and_transport_in_water) {
-		// set all voxels to water (we added it above at the end of 'materials')
-		std::fill(phantom.mediumIndexArray.begin(), phantom.mediumIndexArray.end(), materials.size() - 1);
+	// set all voxels to water (we added it above at the end of 'materials'), in the pass below
+	const bool all_water = sett.in_aqua_vivo || sett.score_and_transport_in_water;
+	const float water = materials.size() - 1;
+
+	//convert the ct to HU units, mass density and materials in one pass, from whatever type the ct was stored in.
+	//z slices are independent, so threads take them in any order and the result is the same as serially.
+	//NOTE: no first touch per thread, so no NUMA placement: gpumcd's Phantom holds std::vector<float> with the standard allocator,
+	//whose resize() zero-fills every page on this thread. the threads speed up the conversion, the pages stay on this node.
+	phantom.massDensityArray.resize(im.nvox());
+	phantom.mediumIndexArray.resize(im.nvox());
+	float* density = phantom.massDensityArray.data();
+	float* medium = phantom.mediumIndexArray.data();
+	const size_t slice = size_t(im.dim_size[0]) * im.dim_size[1];
+	im.visit([&](const auto* voxels){
+		using T = std::decay_t<decltype(*voxels)>;
+		std::shared_ptr<const vector<std::pair<float, float>>> lut;
+		if constexpr (std::is_integral<T>::value) lut = conversion_lut(conversion); //shorts and bytes: every raw value is in the table
+		threads::parallel_for(im.dim_size[2], [&](size_t z){
+			for (size_t i = z * slice; i < (z + 1) * slice; i++){
+				if constexpr (std::is_integral<T>::value){
+					const std::pair<float, float> &e = (*lut)[voxels[i] + 32768];
+					density[i] = e.first;
+					medium[i] = e.second;
+				}
+				else {
+					conversion(types::to_float(voxels[i]), density[i], medium[i]);
+				}
+				if (all_water) medium[i] = water;
+			}
+		}, sett.threads);
+	});
+
+	if (sett.body_mask || sett.in_aqua_vivo) apply_body_mask(phantom, im, conversion); //in_aqua_vivo needs to know where the patient is
+
+	return phantom;
+}
+
+
+void CT::apply_body_mask(Phantom &phantom, const Image &im, const HuConversion &conversion){
+	//the threshold is on mass density, as in pinnacle. the couch y is in plan coordinates, which are minus ours (see the isocenter).
+	int couch_row = -1;
+	float couch_y = -beamMetaData.couchremovalycoordinate;
+	if (std::isfinite(couch_y)) {
+		float row = std::floor((couch_y - im.min_ext[1]) / im.voxel_sizes[1]) + 1; //first row with its center past the couch line
+		couch_row = int(std::min(std::max(row, 0.f), float(im.dim_size[1])));
+	}
+	BodyMask body(phantom.massDensityArray.data(), im.dim_size, beamMetaData.outsidepatientairthreshold, couch_row, sett.threads);
+	if (body.empty()) {
+		if (sett.verbose > 0) cerr << "No patient found above a density of " << beamMetaData.outsidepatientairthreshold << ", the phantom is not masked.\n";
+		return;
 	}
-	if (sett.in_aqua_vivo) {
-		// set all voxels density 1. FIXME: currently sets all to 1, must set 1 only to patient mask
-		
-		//std::fill(phantom.massDensityArray.begin(), phantom.massDensityArray.end(), 1.f);
+	if (sett.verbose > 1) cerr << "patient outline: " << body.count << " voxels, couch from row " << couch_row << "\n";
+
+	//outside gets whatever the configured ct value converts to, normally air
+	float outside_density, outside_medium;
+	conversion(float(beamMetaData.outsidepatientisctnumber), outside_density, outside_medium);
+	if (sett.in_aqua_vivo || sett.score_and_transport_in_water) outside_medium = materials.size() - 1; //water, as in generate_phantom()
+	float* density = phantom.massDensityArray.data();
+	float* medium = phantom.mediumIndexArray.data();
+	const size_t slice = size_t(im.dim_size[0]) * im.dim_size[1];
+	threads::parallel_for(im.dim_size[2], [&](size_t z){
+		for (size_t i = z * slice; i < (z + 1) * slice; i++){
+			if (!body.inside[i]) {
+				density[i] = outside_density;
+				medium[i] = outside_medium;
+			}
+			else if (sett.in_aqua_vivo) density[i] = 1.f; //water density, only in the patient
+		}
+	}, sett.threads);
+
+	//crop to the outline plus margin, so gpumcd does not transport through the air and couch around it
+	vector<int> first(3), size(3);
+	for (int a = 0; a < 3; a++){
+		int margin = int(std::ceil(sett.body_mask_margin / im.voxel_sizes[a]));
+		first[a] = std::max(0, body.box_first[a] - margin);
+		size[a] = std::min(im.dim_size[a] - 1, body.box_last[a] + margin) - first[a] + 1;
 	}
-	
-	return phantom;
+	if (size == im.dim_size) return;
+
+	Phantom cropped;
+	cropped.numVoxels.x = size[0];
+	cropped.numVoxels.y = size[1];
+	cropped.numVoxels.z = size[2];
+	cropped.voxelSizes = phantom.voxelSizes;
+	cropped.phantomCorner.x = phantom.phantomCorner.x + first[0] * phantom.voxelSizes.x;
+	cropped.phantomCorner.y = phantom.phantomCorner.y + first[1] * phantom.voxelSizes.y;
+	cropped.phantomCorner.z = phantom.phantomCorner.z + first[2] * phantom.voxelSizes.z;
+	size_t n = size_t(size[0]) * size[1] * size[2];
+	cropped.massDensityArray.resize(n);
+	cropped.mediumIndexArray.resize(n);
+	threads::parallel_for(size[2], [&](size_t z){
+		for (int y = 0; y < size[1]; y++){
+			size_t from = first[0] + im.dim_size[0] * (first[1] + y + size_t(im.dim_size[1]) * (first[2] + z));
+			size_t to = size[0] * (y + size_t(size[1]) * z);
+			std::copy(density + from, density + from + size[0], cropped.massDensityArray.begin() + to);
+			std::copy(medium + from, medium + from + size[0], cropped.mediumIndexArray.begin() + to);
+		}
+	}, sett.threads);
+	phantom = std::move(cropped);
+}
+
+
+void CT::set_ct_box(const Phantom &p){
+	//the phantom was made on the ct grid, maybe cropped and downsampled, so its extent is a whole nr of ct voxels
+	const float corner[3] = { p.phantomCorner.x, p.phantomCorner.y, p.phantomCorner.z };
+	const float extent[3] = { p.numVoxels.x * p.voxelSizes.x, p.numVoxels.y * p.voxelSizes.y, p.numVoxels.z * p.voxelSizes.z };
+	box_first.assign(3, 0);
+	vector<int> size(3);
+	for (int a = 0; a < 3; a++){
+		box_first[a] = int(std::lround((corner[a] - (image.min_ext[a] - image.voxel_sizes[a] / 2)) / image.voxel_sizes[a]));
+		size[a] = int(std::lround(extent[a] / image.voxel_sizes[a]));
+	}
+	ct_box = image.cropped_grid(box_first, size);
+	grid = ct_box;
+	if (sett.dose_grid_voxel_size > 0) grid = ct_box.coarse_grid(vector<float>(3, sett.dose_grid_voxel_size));
+}
+
+
+uint64_t CT::phantom_key(const HuConversion &conversion) const {
+	//format version, conversion tables and flags, ct geometry and voxels
+	char flags[128];
+	snprintf(flags, sizeof(flags), "phantom 1 water %d %d %d grid %a type %d", int(sett.in_aqua_vivo), int(sett.score_and_transport_in_water), int(sett.score_dose_to_water), sett.dose_grid_voxel_size, int(image.type()));
+	uint64_t key = io::hash64(flags, strlen(flags));
+	if (sett.body_mask || sett.in_aqua_vivo) {
+		snprintf(flags, sizeof(flags), "body %a %a %d %a", sett.body_mask_margin, beamMetaData.outsidepatientairthreshold, beamMetaData.outsidepatientisctnumber, beamMetaData.couchremovalycoordinate);
+		key = io::hash64(flags, strlen(flags), key);
+	}
+	key = io::hash64(conversion.key.data(), conversion.key.size(), key);
+	key = io::hash64(image.dim_size.data(), image.dim_size.size() * sizeof(int), key);
+	key = io::hash64(image.voxel_sizes.data(), image.voxel_sizes.size() * sizeof(float), key);
+	key = io::hash64(image.min_ext.data(), image.min_ext.size() * sizeof(float), key);
+	image.visit([&](const auto* voxels){
+		key = io::hash64(voxels, image.nvox() * sizeof(*voxels), key);
+	});
+	return key;
 }
 
 
 Image CT::generate_image(const vector<float> &new_voxels){
-	assert(new_voxels.size() == image.nvox());
-	Image ret(image);
-	ret.imdata = new_voxels;
-	//ret.imdata.insert(ret.imdata.begin(), new_voxels.begin(), new_voxels.end());
-	return ret;
+	return grid.copy_with_new_voxels(new_voxels); //geometry only, not the ct voxels
 }
 
 
-template <typename T>
-void CT::set_hu2density(const string &fname, const vector<T> &ct_voxels, vector<float> &massDensityArray) {
-	io::isfile(fname, 43);
+Image CT::generate_image(vector<float> &&new_voxels){
+	return grid.copy_with_new_voxels(std::move(new_voxels));
+}
 
-	vector<float> density_hu;
-	vector<float> density;
 
-	std::ifstream is(fname);
+Image CT::dose_on_ct_grid(const Image &dose){
+	if (ct_box.dim_size == image.dim_size) return dose.resampled_to(image);
+	//the phantom covers the body only, the ct around it gets no dose
+	return dose.resampled_to(ct_box).padded_to(image.geometry(), box_first);
+}
+
+
+CT::~CT(){
+	try {
+		flush_output();
+	}
+	catch (const std::pair<int, string> &e) {
+		cerr << "Could not write the debug images: " << e.second << "\n";
+	}
+	catch (const std::exception &e) {
+		cerr << "Could not write the debug images: " << e.what() << "\n";
+	}
+	catch (...) {
+		cerr << "Could not write the debug images.\n";
+	}
+}
+
+
+void CT::flush_output(){
+	if (pending_writes.empty()) return;
+	std::exception_ptr error;
+	for (auto &w : pending_writes){
+		try {
+			w.get();
+		}
+		catch (...) {
+			if (!error) error = std::current_exception();
+		}
+	}
+	pending_writes.clear();
+	try {
+		AsyncImageWriter::global().flush(); //takes our errors off the writer too, so they are not printed again at exit
+	}
+	catch (...) {
+		if (!error) error = std::current_exception();
+	}
+	if (error) std::rethrow_exception(error);
+}
+
+
+Phantom CT::downsample_phantom(const Phantom &fine, const Image &fine_grid, const Image &coarse_grid){
+	//density is the mass over the volume of each coarse voxel, so total mass is conserved.
+	//continuous medium indices mix by weight, so they are averaged weighted by mass. integer indices take the material with most mass.
+	Phantom phantom;
+	phantom.numVoxels.x = coarse_grid.dim_size[0];
+	phantom.numVoxels.y = coarse_grid.dim_size[1];
+	phantom.numVoxels.z = coarse_grid.dim_size[2];
+	phantom.voxelSizes.x = coarse_grid.voxel_sizes[0];
+	phantom.voxelSizes.y = coarse_grid.voxel_sizes[1];
+	phantom.voxelSizes.z = coarse_grid.voxel_sizes[2];
+	phantom.phantomCorner = fine.phantomCorner; //same extent
+
+	auto ox = fine_grid.overlaps(coarse_grid, 0), oy = fine_grid.overlaps(coarse_grid, 1), oz = fine_grid.overlaps(coarse_grid, 2);
+	size_t nx = fine_grid.dim_size[0], nxy = nx * fine_grid.dim_size[1];
+	phantom.massDensityArray.resize(coarse_grid.nvox());
+	phantom.mediumIndexArray.resize(coarse_grid.nvox());
+
+	//coarse z slices are independent, any thread may take any one
+	threads::parallel_for(coarse_grid.dim_size[2], [&](size_t z){
+		vector<double> material_mass(materials.size() + 1), material_volume(materials.size() + 1);
+		size_t i = z * coarse_grid.dim_size[0] * coarse_grid.dim_size[1];
+		for (int y = 0; y < coarse_grid.dim_size[1]; y++){
+			for (int x = 0; x < coarse_grid.dim_size[0]; x++, i++){
+				double volume = 0., mass = 0., index_mass = 0., index_volume = 0.;
+				std::fill(material_mass.begin(), material_mass.end(), 0.);
+				std::fill(material_volume.begin(), material_volume.end(), 0.);
+				for (const auto &fz : oz[z]) for (const auto &fy : oy[y]) for (const auto &fx : ox[x]){
+					size_t f = fx.first + nx * fy.first + nxy * fz.first;
+					double w = double(fx.second) * fy.second * fz.second; //in fine voxel volumes
+					double m = w * fine.massDensityArray[f];
+					volume += w;
+					mass += m;
+					index_mass += m * fine.mediumIndexArray[f];
+					index_volume += w * fine.mediumIndexArray[f];
+					int mat = int(fine.mediumIndexArray[f]);
+					if (mat >= 0 && mat < int(material_mass.size())){
+						material_mass[mat] += m;
+						material_volume[mat] += w;
+					}
+				}
+				phantom.massDensityArray[i] = float(mass / volume);
+				if (sett.continous_materials){
+					phantom.mediumIndexArray[i] = float(mass > 0 ? index_mass / mass : index_volume / volume); //only vacuum falls back to volume
+				}
+				else {
+					const vector<double> &most = mass > 0 ? material_mass : material_volume;
+					phantom.mediumIndexArray[i] = float(std::max_element(most.begin(), most.end()) - most.begin());
+				}
+			}
+		}
+	}, sett.threads);
+	return phantom;
+}
+
+
+HuConversion CT::read_conversion(const string &hu2dens_fname, const string &dens2mat_fname) {
+	HuConversion ret;
+	ret.hu_slope = beamMetaData.hu_slope;
+	ret.hu_intercept = beamMetaData.hu_intercept;
+	ret.continuous = sett.continous_materials;
+	char exact[64];
+	snprintf(exact, sizeof(exact), "%a %a %d\n", ret.hu_slope, ret.hu_intercept, int(ret.continuous)); //hex floats, every bit counts
+	ret.key = exact;
 	string str;
+
+	io::isfile(hu2dens_fname, 43);
+	vector<float> density_hu;
+	vector<float> density;
+	std::ifstream is(hu2dens_fname);
 	while (getline(is, str))
 	{
-		split(str);
+		ret.key += str + "\n";
 		density_hu.push_back( stoi(split(str)[0]) );
 		density.push_back(stof(split(str)[1]));
 	}
+	ret.hu2density = PiecewiseLinear(density_hu, density, true);
 
-	massDensityArray.resize(num_vox());
-
-	for (int i = 0; i < num_vox(); i++){
-		massDensityArray[i] = interpolate(density_hu, density, ct_voxels[i], true);
-		if (massDensityArray[i] < 0) massDensityArray[i] = 0.f;
-	}
-};
-
-
-void CT::set_density2material(const string &fname, const vector<float> &massDensityArray, vector<float> &mediumIndexArray) {
-	assert(massDensityArray.size()>0);//this ensures the densities are available.
-	io::isfile(fname, 45);
-	
 	//use dens2mat with data from AvL clinic and Monaco defaults in appendix C of research manual.
-	//NOTE: indices are continuous: a matindex of 1.4 will be a mix of 40% material 1 and 60% material 2 by weight.
 	//gpumcd uses continuous material indices to mix materials. this vector helps.
+	io::isfile(dens2mat_fname, 45);
 	vector<int> continuous_material_index_axis;
 	int i = 0;
-
-	//load file into following. 'matireals' is a class member, because gpumcd later needs it
-	vector<std::pair<int, int>> material_hu;
-	vector<float> material_dens; //if used, indices must map to 'material' member
-
-	std::ifstream is(fname);
-	string str;
-	while (getline(is, str))
+	std::ifstream ms(dens2mat_fname);
+	ret.key += "\n";
+	while (getline(ms, str))
 	{
-		split(str);
-		material_dens.push_back(stof(split(str)[0]));
-		materials.push_back(split(str)[1]);
+		ret.key += str + "\n";
+		ret.material_dens.push_back(stof(split(str)[0]));
+		materials.push_back(split(str)[1]); //'materials' is a class member, because gpumcd later needs it
 		continuous_material_index_axis.push_back(i++);
 	}
+	if (ret.continuous) ret.density2material = PiecewiseLinear(ret.material_dens, continuous_material_index_axis, false);
+	//if (phantom.mediumIndexArray[i] < 1) phantom.mediumIndexArray[i] = 0.f; //clip first materials (probably air)
+	return ret;
+};
 
-	mediumIndexArray.resize(num_vox());
 
-	if (sett.continous_materials){
-		for (int i = 0; i < num_vox(); i++){
-			mediumIndexArray[i] = interpolate(material_dens, continuous_material_index_axis, massDensityArray[i], false);
-			//if (phantom.mediumIndexArray[i] < 1) phantom.mediumIndexArray[i] = 0.f; //clip first materials (probably air)
-		}
-	}
-	else { //integer materials
-		for (int i = 0; i < num_vox(); i++){
-			mediumIndexArray[i] = 0; //any densities lower than minimum found in file are assumed to be of material at first line.
-			for (int j = 0; j < material_dens.size(); j++){
-				if (material_dens[j]>massDensityArray[i]){
-					break;
-				}
-				mediumIndexArray[i] = j;
-			}
+std::shared_ptr<const vector<std::pair<float, float>>> CT::conversion_lut(const HuConversion &conversion) {
+	//(density, medium) for every raw short, index raw + 32768. built once per conversion, a few per process at most.
+	static std::map<string, std::shared_ptr<const vector<std::pair<float, float>>>> cache;
+	static std::mutex cache_mutex;
+	std::lock_guard<std::mutex> lock(cache_mutex);
+	auto &lut = cache[conversion.key];
+	if (!lut){
+		auto table = std::make_shared<vector<std::pair<float, float>>>(65536);
+		for (int raw = -32768; raw < 32768; raw++){
+			auto &e = (*table)[raw + 32768];
+			conversion(float(raw), e.first, e.second);
 		}
+		lut = table;
 	}
+	return lut;
 };
 
 
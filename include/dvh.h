@@ -0,0 +1,155 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <algorithm> //std::min, std::max
+#include <assert.h>
+#include "image.h"
+#include "threads.h" //count, parallel_for
+
+/*
+ * Dose volume histograms of any nr of structures in one pass over the dose.
+ * Masks are images on the dose grid whose voxels are the fraction of the voxel in the structure (0 to 1),
+ * so binary masks and partial volumes are the same thing. Each thread fills its own histograms of a contiguous set of z slices,
+ * dose bins of a slice are computed once and then every mask streams over them.
+ * Volumes are summed as fixed point fractions, so they are exact and the same for any nr of threads,
+ * as are the means, whose partial sums are per slice and added in z order.
+ * Voxels without a finite dose are left out. Doses beyond max_bins bins go in the last bin, so garbage cannot blow up the histograms.
+ */
+
+class DVH {
+public:
+	DVH(const Image &, const std::vector<Image> &, float = 0.01f, unsigned int = 0); //dose, masks, bin width in units of dose, nthreads
+
+	struct Histogram {
+		std::vector<double> differential; //cm3 per dose bin [i, i+1) * bin_width
+		float bin_width = 0.f;
+		double volume = 0.; //cm3, partial voxels included
+		float min = 0.f; //over voxels with any part in the structure
+		float max = 0.f;
+		float mean = 0.f; //volume weighted
+
+		std::vector<double> cumulative() const; //cm3 receiving at least i * bin_width
+		float D(float) const; //lowest dose in the hottest given % of the volume, e.g. D(95)
+		float V(float) const; //% of the volume receiving at least the given dose
+	};
+
+	std::vector<Histogram> structures; //in the order of the masks
+
+private:
+	static constexpr double weight_scale = 1 << 24; //fixed point unit of volume, a float weight in [0, 1] has no more bits
+	static constexpr uint32_t max_bins = 1 << 16; //per histogram, 655 Gy at the default width
+	static constexpr uint32_t no_bin = ~uint32_t(0); //NaN or infinite dose
+
+	static uint64_t weight(float w){ return uint64_t(std::lround(std::min(w, 1.f) * weight_scale)); };
+};
+
+
+DVH::DVH(const Image &dose, const std::vector<Image> &masks, float bin_width, unsigned int nthreads){
+	assert(dose.ndim() == 3 && bin_width > 0);
+	for (const auto &m : masks) assert(m.dim_size == dose.dim_size);
+	const size_t nstruct = masks.size();
+	const int nz = dose.dim_size[2];
+	const size_t slice = size_t(dose.dim_size[0]) * dose.dim_size[1];
+	const float inv_width = 1.f / bin_width;
+
+	//per thread: fixed point volume per bin per structure, grown as higher doses come by
+	const size_t nworkers = std::max<size_t>(1, std::min<size_t>(threads::count(nthreads), nz));
+	std::vector<std::vector<std::vector<uint64_t>>> bins(nworkers, std::vector<std::vector<uint64_t>>(nstruct));
+	std::vector<double> slice_dose(size_t(nz) * nstruct, 0.); //sum of weight * dose
+	std::vector<float> lo(nworkers * nstruct, INFINITY), hi(nworkers * nstruct, -INFINITY);
+
+	threads::parallel_for(nworkers, [&](size_t t){
+		std::vector<float> d(slice);
+		std::vector<uint32_t> b(slice);
+		for (int z = int(t * nz / nworkers); z < int((t + 1) * nz / nworkers); z++){
+			const size_t first = z * slice;
+			for (size_t i = 0; i < slice; i++){
+				d[i] = dose.voxel(first + i);
+				b[i] = std::isfinite(d[i]) ? uint32_t(std::min(std::max(d[i], 0.f) * inv_width, float(max_bins - 1))) : no_bin;
+			}
+			for (size_t s = 0; s < nstruct; s++){
+				std::vector<uint64_t> &h = bins[t][s];
+				double sum = 0.;
+				float &mn = lo[t * nstruct + s], &mx = hi[t * nstruct + s];
+				masks[s].visit([&](const auto* m){
+					m += first;
+					for (size_t i = 0; i < slice; i++){
+						float f = types::to_float(m[i]);
+						if (!(f > 0) || b[i] == no_bin) continue;
+						uint64_t w = weight(f);
+						if (b[i] >= h.size()) h.resize(b[i] + 1, 0);
+						h[b[i]] += w;
+						sum += double(w) * d[i];
+						mn = std::min(mn, d[i]);
+						mx = std::max(mx, d[i]);
+					}
+				});
+				slice_dose[z * nstruct + s] = sum;
+			}
+		}
+	}, nthreads);
+
+	const double voxel_volume = double(dose.voxel_sizes[0]) * dose.voxel_sizes[1] * dose.voxel_sizes[2];
+	structures.resize(nstruct);
+	for (size_t s = 0; s < nstruct; s++){
+		Histogram &ret = structures[s];
+		ret.bin_width = bin_width;
+		std::vector<uint64_t> total;
+		float mn = INFINITY, mx = -INFINITY;
+		for (size_t t = 0; t < nworkers; t++){
+			const std::vector<uint64_t> &h = bins[t][s];
+			if (h.size() > total.size()) total.resize(h.size(), 0);
+			for (size_t i = 0; i < h.size(); i++) total[i] += h[i];
+			mn = std::min(mn, lo[t * nstruct + s]);
+			mx = std::max(mx, hi[t * nstruct + s]);
+		}
+		uint64_t count = 0;
+		ret.differential.resize(total.size());
+		for (size_t i = 0; i < total.size(); i++){
+			count += total[i];
+			ret.differential[i] = total[i] / weight_scale * voxel_volume;
+		}
+		if (count == 0) continue; //empty structure, all zero
+		double sum = 0.;
+		for (int z = 0; z < nz; z++) sum += slice_dose[z * nstruct + s];
+		ret.volume = count / weight_scale * voxel_volume;
+		ret.mean = float(sum / count);
+		ret.min = mn;
+		ret.max = mx;
+	}
+}
+
+
+std::vector<double> DVH::Histogram::cumulative() const {
+	std::vector<double> ret(differential.size() + 1, 0.);
+	for (size_t i = differential.size(); i-- > 0;) ret[i] = ret[i + 1] + differential[i];
+	return ret;
+}
+
+
+float DVH::Histogram::D(float percent) const {
+	//doses are taken as uniform within a bin
+	if (volume <= 0.) return 0.f;
+	double target = volume * std::min(std::max(percent, 0.f), 100.f) / 100.;
+	std::vector<double> c = cumulative();
+	for (size_t i = differential.size(); i-- > 0;){
+		if (c[i] < target) continue;
+		double frac = differential[i] > 0 ? (c[i] - target) / differential[i] : 0.;
+		return float((i + frac) * bin_width);
+	}
+	return 0.f;
+}
+
+
+float DVH::Histogram::V(float dose) const {
+	if (volume <= 0.) return 0.f;
+	if (dose <= 0.f) return 100.f;
+	double u = dose / bin_width;
+	size_t i = size_t(u);
+	if (i >= differential.size()) return 0.f;
+	std::vector<double> c = cumulative();
+	double at = c[i + 1] + differential[i] * (1. - (u - i));
+	return float(100. * at / volume);
+}
@@ -40,13 +40,15 @@ FluenceImage::FluenceImage(const string &fn) : Image(fn) {
 	std::pair<float, float> fieldMin;
 	std::pair<float, float> fieldMax;*/
 
+	auto fluence = view<float, 2>();
 	for (int y = 0; y < dim_size[1]; y++){
 		for (int x = 0; x < dim_size[0]; x++){
 			// todo convert x,y afmetingen in isoc
 			// plus and minus halfpixel
-			beaminfos[x + y*x].relativeWeight = imdata[x + y*x];
-			beaminfos[x + y*x].fieldMin = { min_ext[0] + (x - 0.5)*voxel_sizes[0], min_ext[1] + (y - 0.5)*voxel_sizes[1] };
-			beaminfos[x + y*x].fieldMax = { min_ext[0] + (x + 0.5)*voxel_sizes[0], min_ext[1] + (y + 0.5)*voxel_sizes[1] };
+			size_t i = fluence.index(x, y);
+			beaminfos[i].relativeWeight = fluence.data()[i];
+			beaminfos[i].fieldMin = { min_ext[0] + (x - 0.5)*voxel_sizes[0], min_ext[1] + (y - 0.5)*voxel_sizes[1] };
+			beaminfos[i].fieldMax = { min_ext[0] + (x + 0.5)*voxel_sizes[0], min_ext[1] + (y + 0.5)*voxel_sizes[1] };
 		}
 	}
 
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cmath>
+#include <algorithm> //std::sort, std::min, std::max
+#include <memory> //std::unique_ptr
+#include <iostream> //std::cerr
+#include <assert.h>
+#include "image.h"
+#include "threads.h" //parallel_for
+#include "settings.h"
+
+/*
+ * 3D gamma index (Low et al. 1998) of an evaluated dose against a reference dose, on any two grids.
+ * For every reference voxel above the isodose region, gamma^2 is the minimum over positions r of the evaluated dose of
+ *   |r - r_ref|^2 / dta^2 + (D_eval(r) - D_ref)^2 / dd^2,
+ * with D_eval trilinear between the evaluated voxels. The search is a fixed lattice of offsets within max_gamma * dta,
+ * sorted by distance: once the distance term alone reaches the best gamma found, no later offset can improve on it.
+ * Most voxels pass within the first few offsets, so the cost is close to one interpolation per voxel.
+ * The best lattice point is then refined by a pattern search with steps of a half, a quarter and an eighth of the lattice spacing.
+ * So gamma is an approximation from above: never more than the lattice minimum, and usually within a small fraction of the
+ * lattice spacing of the true one, but a narrow minimum between lattice points can still be missed.
+ * Voxels above max_gamma get max_gamma. Reference slices run on any thread, the result is the same.
+ */
+
+struct GammaCriteria {
+	float dd = 3.f; //dose difference, % of the maximum reference dose (global) or of the local reference dose
+	float dta = 0.2f; //distance to agreement, cm
+	bool global = true;
+	float isodose_region = 10.f; //% of the maximum reference dose, voxels below are not evaluated
+	float max_gamma = 2.f; //search radius in units of dta
+	int steps_per_dta = 3; //offset lattice spacing is dta / steps_per_dta
+	int refine_levels = 3; //halvings of the lattice spacing in the search around the best lattice point, 0 for the lattice alone
+
+	GammaCriteria() = default;
+	GammaCriteria(const DosiaSettings &); //the [gamma] section
+};
+
+
+class GammaIndex {
+public:
+	GammaIndex(const Image &, const Image &, const GammaCriteria & = GammaCriteria(), unsigned int = 0); //reference, evaluated, criteria, nthreads
+
+	Image gamma; //on the reference grid, -1 where not evaluated
+	size_t evaluated = 0; //nr of voxels in the isodose region
+	size_t passed = 0; //of those, nr with gamma <= 1
+	float mean = 0.f; //over the evaluated voxels
+	float max = 0.f;
+
+	float pass_rate() const { return evaluated ? 100.f * passed / evaluated : 0.f; }; //%
+	std::string summary() const;
+
+	//the comparison of a run: nothing unless [gamma] comparison is set. on sett.threads, the summary goes to cerr when verbose,
+	//the gamma image to rt_files/gamma.xdr with dbgoutput.
+	static std::unique_ptr<GammaIndex> compare(const DosiaSettings &, const Image &, const Image &); //reference, evaluated
+
+private:
+	struct Offset {
+		float dx, dy, dz; //in evaluated voxels
+		float a, b, c; //in dta
+		float d2; //(distance / dta)^2
+	};
+
+	GammaCriteria criteria;
+};
+
+
+GammaCriteria::GammaCriteria(const DosiaSettings &sett) : dd(sett.gamma_dd), dta(sett.gamma_dta / 10.f), global(sett.gamma_global_dose), isodose_region(sett.gamma_isodose_region){ //dta is mm in ini
+}
+
+
+GammaIndex::GammaIndex(const Image &reference, const Image &evaluated_dose, const GammaCriteria &_criteria, unsigned int nthreads) : criteria(_criteria){
+	assert(reference.ndim() == 3 && evaluated_dose.ndim() == 3);
+	assert(criteria.dd > 0 && criteria.dta > 0 && criteria.max_gamma > 0 && criteria.steps_per_dta > 0);
+
+	//trilinear sampling below wants plain floats
+	Image converted;
+	const Image* eval = &evaluated_dose;
+	if (evaluated_dose.type() != types::VoxelType::FLOAT32){
+		converted = evaluated_dose.converted(types::VoxelType::FLOAT32);
+		eval = &converted;
+	}
+	const float* ed = eval->data<float>();
+	const int ex = eval->dim_size[0], ey = eval->dim_size[1], ez = eval->dim_size[2];
+	const size_t exy = size_t(ex) * ey;
+
+	//offsets within the search radius, nearest first. equal distances keep a fixed order, so ties break the same on every run.
+	const float step = criteria.dta / criteria.steps_per_dta;
+	const int reach = int(std::ceil(criteria.max_gamma * criteria.steps_per_dta));
+	const float max_d2 = criteria.max_gamma * criteria.max_gamma;
+	std::vector<Offset> offsets;
+	for (int k = -reach; k <= reach; k++){
+		for (int j = -reach; j <= reach; j++){
+			for (int i = -reach; i <= reach; i++){
+				float d2 = float(i * i + j * j + k * k) / (criteria.steps_per_dta * criteria.steps_per_dta);
+				if (d2 > max_d2) continue;
+				offsets.push_back({ i * step / eval->voxel_sizes[0], j * step / eval->voxel_sizes[1], k * step / eval->voxel_sizes[2],
+					float(i) / criteria.steps_per_dta, float(j) / criteria.steps_per_dta, float(k) / criteria.steps_per_dta, d2 });
+			}
+		}
+	}
+	std::stable_sort(offsets.begin(), offsets.end(), [](const Offset &a, const Offset &b){ return a.d2 < b.d2; });
+	const float to_voxels[3] = { criteria.dta / eval->voxel_sizes[0], criteria.dta / eval->voxel_sizes[1], criteria.dta / eval->voxel_sizes[2] }; //dta to evaluated voxels
+
+	float ref_max = 0.f;
+	for (int i = 0; i < reference.nvox(); i++) ref_max = std::max(ref_max, reference.voxel(i));
+	const float cutoff = criteria.isodose_region / 100.f * ref_max;
+	const float global_dd = criteria.dd / 100.f * ref_max;
+
+	//D_eval at a position in evaluated voxels. half a voxel beyond the outer centers is still in the grid, further out there is no dose.
+	auto sample = [&](float u, float v, float w, float &dose){
+		if (u < -0.5f || v < -0.5f || w < -0.5f || u > ex - 0.5f || v > ey - 0.5f || w > ez - 0.5f) return false;
+		u = std::min(std::max(u, 0.f), float(ex - 1));
+		v = std::min(std::max(v, 0.f), float(ey - 1));
+		w = std::min(std::max(w, 0.f), float(ez - 1));
+		int i0 = std::min(int(u), ex - 1), j0 = std::min(int(v), ey - 1), k0 = std::min(int(w), ez - 1);
+		int i1 = std::min(i0 + 1, ex - 1), j1 = std::min(j0 + 1, ey - 1), k1 = std::min(k0 + 1, ez - 1);
+		float fu = u - i0, fv = v - j0, fw = w - k0;
+		const float* p00 = ed + j0 * size_t(ex) + k0 * exy;
+		const float* p10 = ed + j1 * size_t(ex) + k0 * exy;
+		const float* p01 = ed + j0 * size_t(ex) + k1 * exy;
+		const float* p11 = ed + j1 * size_t(ex) + k1 * exy;
+		float c00 = p00[i0] + (p00[i1] - p00[i0]) * fu;
+		float c10 = p10[i0] + (p10[i1] - p10[i0]) * fu;
+		float c01 = p01[i0] + (p01[i1] - p01[i0]) * fu;
+		float c11 = p11[i0] + (p11[i1] - p11[i0]) * fu;
+		float c0 = c00 + (c10 - c00) * fv;
+		float c1 = c01 + (c11 - c01) * fv;
+		dose = c0 + (c1 - c0) * fw;
+		return true;
+	};
+
+	gamma = reference.geometry();
+	gamma.imdata.assign(reference.nvox(), -1.f);
+	const int rx = reference.dim_size[0], ry = reference.dim_size[1], rz = reference.dim_size[2];
+	std::vector<size_t> slice_evaluated(rz, 0), slice_passed(rz, 0);
+	std::vector<double> slice_sum(rz, 0.);
+	std::vector<float> slice_max(rz, 0.f);
+
+	threads::parallel_for(rz, [&](size_t z){
+		float* g = gamma.imdata.data() + z * size_t(rx) * ry;
+		//position of the reference voxel in evaluated voxels
+		float w = (reference.min_ext[2] + z * reference.voxel_sizes[2] - eval->min_ext[2]) / eval->voxel_sizes[2];
+		for (int y = 0; y < ry; y++){
+			float v = (reference.min_ext[1] + y * reference.voxel_sizes[1] - eval->min_ext[1]) / eval->voxel_sizes[1];
+			for (int x = 0; x < rx; x++, g++){
+				float ref = reference.voxel(x + size_t(rx) * (y + size_t(ry) * z));
+				if (ref < cutoff || ref <= 0.f) continue;
+				float u = (reference.min_ext[0] + x * reference.voxel_sizes[0] - eval->min_ext[0]) / eval->voxel_sizes[0];
+				float dd = criteria.global ? global_dd : criteria.dd / 100.f * ref;
+				float inv_dd2 = 1.f / (dd * dd);
+				float best = max_d2;
+				const Offset* at = nullptr;
+				for (const Offset &o : offsets){
+					if (o.d2 >= best) break; //sorted, nothing further can do better
+					float dose;
+					if (!sample(u + o.dx, v + o.dy, w + o.dz, dose)) continue;
+					float g2 = o.d2 + (dose - ref) * (dose - ref) * inv_dd2;
+					if (g2 < best){
+						best = g2;
+						at = &o;
+					}
+				}
+				//pattern search around the best lattice point, along each axis, with ever smaller steps
+				if (at != nullptr && best > 0.f){
+					float p[3] = { at->a, at->b, at->c };
+					float h = 0.5f / criteria.steps_per_dta;
+					for (int level = 0; level < criteria.refine_levels; level++, h *= 0.5f){
+						for (bool moved = true; moved;){
+							moved = false;
+							for (int m = 0; m < 6; m++){
+								float q[3] = { p[0], p[1], p[2] };
+								q[m / 2] += (m % 2) ? h : -h;
+								float d2 = q[0] * q[0] + q[1] * q[1] + q[2] * q[2];
+								if (d2 >= best) continue;
+								float dose;
+								if (!sample(u + q[0] * to_voxels[0], v + q[1] * to_voxels[1], w + q[2] * to_voxels[2], dose)) continue;
+								float g2 = d2 + (dose - ref) * (dose - ref) * inv_dd2;
+								if (g2 < best){
+									best = g2;
+									p[0] = q[0];
+									p[1] = q[1];
+									p[2] = q[2];
+									moved = true;
+								}
+							}
+						}
+					}
+				}
+				*g = std::sqrt(best);
+				slice_evaluated[z]++;
+				slice_passed[z] += (*g <= 1.f);
+				slice_sum[z] += *g;
+				slice_max[z] = std::max(slice_max[z], *g);
+			}
+		}
+	}, nthreads);
+
+	double sum = 0.;
+	for (int z = 0; z < rz; z++){
+		evaluated += slice_evaluated[z];
+		passed += slice_passed[z];
+		sum += slice_sum[z];
+		max = std::max(max, slice_max[z]);
+	}
+	mean = evaluated ? float(sum / evaluated) : 0.f;
+}
+
+
+std::unique_ptr<GammaIndex> GammaIndex::compare(const DosiaSettings &sett, const Image &reference, const Image &evaluated){
+	if (!sett.gamma_comparison) return nullptr;
+	auto ret = std::make_unique<GammaIndex>(reference, evaluated, GammaCriteria(sett), sett.threads);
+	if (sett.verbose > 0) std::cerr << ret->summary() << "\n";
+	if (sett.dbgoutput) ret->gamma.write(os::path::join(sett.rt_files, "gamma.xdr"));
+	return ret;
+}
+
+
+std::string GammaIndex::summary() const {
+	char ret[256];
+	snprintf(ret, sizeof(ret), "gamma %s %.1f%%/%.1fmm, isodose region %.0f%%: %.2f%% of %zu voxels pass, mean %.3f, max %.3f%s",
+		criteria.global ? "global" : "local", criteria.dd, criteria.dta * 10.f, criteria.isodose_region,
+		pass_rate(), evaluated, mean, max, max >= criteria.max_gamma ? " (or more)" : "");
+	return ret;
+}
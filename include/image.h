@@ -3,44 +3,130 @@
 #include <iostream>
 #include "pystring.h" //pystring
 #include "tools.h" //vect,std::vector
+#include "simd.h" //byteswap kernels
+#include "imageview.h" //ImageView
+#include "threads.h" //parallel_for, ThreadPool
+#include <zlib.h> //compressed .mhd
 #include <cstring> //std::memcpy
+#include <type_traits> //std::decay_t
+#include <limits> //std::numeric_limits
 #include "gpumcd/Phantom.h"
 using namespace vect;
 using namespace pystring;
 
+/*
+ * Needs C++17 (if constexpr, std::decay_t in visit()), zlib for compressed .mhd (link -lz) and threads (-pthread).
+ */
+
+enum class ImageLoad {
+	FLOAT, // voxels are converted to floats in imdata
+	NATIVE, // voxels keep their file type (short, uchar, float), see type() and data<T>()
+	MAPPED // as NATIVE, but .mhd raw data is mapped read-only and read in place. .xdr falls back to NATIVE.
+};
+
+//what a header says, without touching the voxels. see Image::probe().
+struct ImageInfo {
+	vector<int> dim_size;
+	vector<float> voxel_sizes;
+	vector<float> min_ext;
+	vector<float> max_ext;
+	types::VoxelType type = types::VoxelType::FLOAT32; // on disk
+
+	std::string datafile; // file holding the voxels: the .xdr itself or the .mhd's (z)raw
+	size_t offset = 0; // of the voxels in datafile
+	bool big_endian = false; // xdr
+	bool compressed = false;
+	size_t compressed_size = 0; // 0: whole file
+	size_t block_size = 0; // 0: one zlib stream
+	vector<size_t> block_offsets;
+
+	//blocks are raw deflate pieces of one zlib stream when the first starts after the zlib header, see Image::write_mhd.
+	//offsets from 0 are whole zlib streams per block.
+	bool blocks_in_one_stream() const { return !block_offsets.empty() && block_offsets[0] > 0; };
+
+	int ndim() const { return dim_size.size(); };
+	int nvox() const { return mul(dim_size); };
+	size_t nbytes() const { return size_t(nvox()) * types::voxel_size(type); }; // uncompressed voxels
+};
+
 class Image{
 public:
 	vector<int> dim_size;
 	vector<float> voxel_sizes;
 	vector<float> min_ext;
 	vector<float> max_ext;
-	vector<float> imdata; // watch out! I convert all to floats! my world is simple!
+	vector<float> imdata; // float voxels. empty unless type() is FLOAT32 and not mapped(), see floats().
 
 	Image() = default;
 	~Image() = default;
-	Image(const std::string &);
+	Image(const Image &) = default;
+	Image(Image &&) = default;
+	Image &operator=(const Image &) = default;
+	Image &operator=(Image &&) = default;
+	Image(const std::string &, ImageLoad = ImageLoad::FLOAT);
+	Image(const Image &, vector<float> &&); // geometry of the first, takes over the voxels
 
-	void write(const std::string &);
-	Image copy_with_new_voxels(const vector<float> &);
+	static ImageInfo probe(const std::string &); // parses only the header
+	static vector<Image> load(const vector<std::string> &, ImageLoad = ImageLoad::FLOAT, unsigned int = 0); // fnames, load, nthreads (0: all cores). files are read concurrently.
+
+	void write(const std::string &, bool = false) const; //fname, compress (.mhd only). a mapped image is written from the mapping.
+	Image copy_with_new_voxels(const vector<float> &) const; // geometry only, voxels are never copied from this
+	Image copy_with_new_voxels(vector<float> &&) const;
 
 	int ndim() const { return dim_size.size(); };
 	int nvox() const { return mul(dim_size); };
 
+	types::VoxelType type() const { return vtype; };
+	bool mapped() const { return mapping != nullptr; };
+	template <typename T> const T* data() const; // native voxels, T must match type()
+	template <typename T> T* data(); // same, but owned: a mapping is copied first
+	template <typename F> void visit(F &&) const; // calls f(const T*) with the native voxels
+	template <typename T, size_t N> ImageView<const T, N> view() const; // N must be ndim()
+	template <typename T, size_t N> ImageView<T, N> view();
+	float voxel(size_t) const; // any type, converted on the fly
+	vector<float> &floats(); // owned float voxels for callers that mutate. converts once.
+	void convert(types::VoxelType); // change element type, integers are clamped and rounded
+	Image converted(types::VoxelType) const; // same, into a new image
+
+	Image geometry() const; // copy without voxels
+	Image coarse_grid(const vector<float> &) const; // geometry over the same extent, with voxels of about the given size
+	vector<vector<std::pair<int, float>>> overlaps(const Image &, int) const; // per voxel of the other grid along axis: our voxels in it and the fraction of each
+	Image downsample(const vector<float> &) const; // volume weighted average onto coarse_grid()
+	float sample(float, float, float) const; // trilinear, at a position in cm, clamped to the grid
+	Image resampled_to(const Image &) const; // sample() at every voxel of another grid, e.g. coarse dose back to the ct
+	Image cropped_grid(const vector<int> &, const vector<int> &) const; // geometry of the sub volume at voxel first, of size voxels
+	Image padded_to(const Image &, const vector<int> &, float = 0.f) const; // into a larger grid at voxel first, value outside us
+
 private:
-	void read_xdr(const std::string &);
-	void read_mhd(const std::string &);
+	friend class TiledImage; // reads slabs through read() and inflate()
+
+	std::shared_ptr<io::mmap_file> mapping; // copies of a mapped image share the mapping
+	types::VoxelType vtype = types::VoxelType::FLOAT32;
+	vector<char> rawdata; // owned voxels of any type but FLOAT32
+
+	static constexpr size_t io_block_bytes = 1 << 20; //xdr voxels are (de)coded per block, peak memory is image + one block
+
+	const char* bytes() const;
+	char* owned_bytes();
+	void allocate(types::VoxelType);
+	void own(); // copy a mapping into owned storage
+
+	static ImageInfo probe_xdr(const std::string &);
+	static ImageInfo probe_mhd(const std::string &);
+	void read(const ImageInfo &, ImageLoad); // voxels of a probed file
+
+	void write_xdr(const std::string &) const;
+	void write_mhd(const std::string &, bool) const;
 
-	void write_xdr(const std::string &);
-	void write_mhd(const std::string &);
+	//.zraw: independently deflated blocks of this many raw bytes, so threads can (de)compress them at once
+	static constexpr size_t zraw_block_bytes = 1 << 22;
+	static void inflate(const char*, size_t, char*, size_t, const std::string &, bool = false); //raw: a block of one stream, no header or end
 };
 
 
-Image::Image(const std::string &fname){
-	if (pystring::endswith(fname, ".xdr")){
-		read_xdr(fname);
-	}
-	else if (pystring::endswith(fname, ".mhd")){
-		read_mhd(fname);
+Image::Image(const std::string &fname, ImageLoad load){
+	if (pystring::endswith(fname, ".xdr") || pystring::endswith(fname, ".mhd")){
+		read(probe(fname), load);
 	}
 	else {
 		printf("Unkown file extension encountered, aborting write out...");
@@ -48,12 +134,370 @@ Image::Image(const std::string &fname){
 }
 
 
-void Image::write(const std::string &fname){
+ImageInfo Image::probe(const std::string &fname){
+	if (pystring::endswith(fname, ".xdr")) return probe_xdr(fname);
+	if (pystring::endswith(fname, ".mhd")) return probe_mhd(fname);
+	throw std::pair<int, std::string>(72, "Unknown file extension of '" + fname + "'.");
+}
+
+
+vector<Image> Image::load(const vector<std::string> &fnames, ImageLoad load, unsigned int nthreads){
+	vector<ImageInfo> infos(fnames.size());
+	vector<Image> images(fnames.size());
+	threads::ThreadPool pool(nthreads);
+
+	//waits for all, so nothing still runs on infos or images when the first error is rethrown
+	auto wait = [](vector<std::future<void>> &futures){
+		std::exception_ptr error;
+		for (auto &f : futures){
+			try {
+				f.get();
+			}
+			catch (...) {
+				if (!error) error = std::current_exception();
+			}
+		}
+		if (error) std::rethrow_exception(error);
+	};
+
+	//headers first
+	vector<std::future<void>> probes;
+	for (size_t i = 0; i < fnames.size(); i++){
+		probes.push_back(pool.submit([&, i]{ infos[i] = probe(fnames[i]); }));
+	}
+	wait(probes);
+
+	//all buffers are allocated before any voxel is read, read() fills them in place
+	for (size_t i = 0; i < fnames.size(); i++){
+		if (infos[i].compressed || (load == ImageLoad::MAPPED && !infos[i].big_endian)) continue;
+		images[i].dim_size = infos[i].dim_size;
+		images[i].allocate(load == ImageLoad::FLOAT ? types::VoxelType::FLOAT32 : infos[i].type);
+	}
+
+	vector<std::future<void>> reads;
+	for (size_t i = 0; i < fnames.size(); i++){
+		reads.push_back(pool.submit([&, i]{ images[i].read(infos[i], load); }));
+	}
+	wait(reads);
+	return images;
+}
+
+
+Image::Image(const Image &geom, vector<float> &&voxels) : dim_size(geom.dim_size), voxel_sizes(geom.voxel_sizes), min_ext(geom.min_ext), max_ext(geom.max_ext), imdata(std::move(voxels)){
+	assert(imdata.size() == nvox());
+}
+
+
+Image Image::geometry() const {
+	Image ret;
+	ret.dim_size = dim_size;
+	ret.voxel_sizes = voxel_sizes;
+	ret.min_ext = min_ext;
+	ret.max_ext = max_ext;
+	return ret;
+}
+
+
+Image Image::copy_with_new_voxels(const vector<float> &new_voxels) const {
+	return Image(*this, vector<float>(new_voxels));
+}
+
+
+Image Image::copy_with_new_voxels(vector<float> &&new_voxels) const {
+	return Image(*this, std::move(new_voxels));
+}
+
+
+const char* Image::bytes() const {
+	if (mapped()) return mapping->data();
+	if (vtype == types::VoxelType::FLOAT32) return reinterpret_cast<const char*>(imdata.data());
+	return rawdata.data();
+}
+
+
+char* Image::owned_bytes(){
+	assert(!mapped());
+	if (vtype == types::VoxelType::FLOAT32) return reinterpret_cast<char*>(imdata.data());
+	return rawdata.data();
+}
+
+
+void Image::allocate(types::VoxelType type){
+	//owned, uninitialized storage for nvox() voxels of type
+	mapping.reset();
+	vtype = type;
+	if (type == types::VoxelType::FLOAT32){
+		vector<char>().swap(rawdata);
+		imdata.resize(nvox());
+	}
+	else {
+		vector<float>().swap(imdata);
+		rawdata.resize(nvox() * types::voxel_size(type));
+	}
+}
+
+
+void Image::own(){
+	if (!mapped()) return;
+	auto source = mapping; //keep alive while we copy
+	allocate(vtype);
+	std::memcpy(owned_bytes(), source->data(), nvox() * types::voxel_size(vtype));
+}
+
+
+template <typename T>
+const T* Image::data() const {
+	assert(types::voxel_type<T>() == vtype);
+	return reinterpret_cast<const T*>(bytes());
+}
+
+
+template <typename T>
+T* Image::data() {
+	assert(types::voxel_type<T>() == vtype);
+	own();
+	return reinterpret_cast<T*>(owned_bytes());
+}
+
+
+template <typename F>
+void Image::visit(F &&f) const {
+	switch (vtype){
+	case types::VoxelType::INT16: f(data<short>()); break;
+	case types::VoxelType::UINT8: f(data<unsigned char>()); break;
+	case types::VoxelType::FLOAT16: f(data<types::half>()); break;
+	default: f(data<float>()); break;
+	}
+}
+
+
+template <typename T, size_t N>
+ImageView<const T, N> Image::view() const {
+	assert(ndim() == N);
+	std::array<size_t, N> dims;
+	for (size_t a = 0; a < N; a++) dims[a] = dim_size[a];
+	return ImageView<const T, N>(data<T>(), dims);
+}
+
+
+template <typename T, size_t N>
+ImageView<T, N> Image::view() {
+	assert(ndim() == N);
+	std::array<size_t, N> dims;
+	for (size_t a = 0; a < N; a++) dims[a] = dim_size[a];
+	return ImageView<T, N>(data<T>(), dims);
+}
+
+
+float Image::voxel(size_t i) const {
+	switch (vtype){
+	case types::VoxelType::INT16: return data<short>()[i];
+	case types::VoxelType::UINT8: return data<unsigned char>()[i];
+	case types::VoxelType::FLOAT16: return types::half_to_float(data<types::half>()[i]);
+	default: return data<float>()[i];
+	}
+}
+
+
+vector<float> &Image::floats(){
+	if (vtype != types::VoxelType::FLOAT32 || mapped()){
+		*this = converted(types::VoxelType::FLOAT32); //other copies may still hold the mapping
+	}
+	return imdata;
+}
+
+
+void Image::convert(types::VoxelType type){
+	if (type == vtype){
+		own();
+		return;
+	}
+	*this = converted(type);
+}
+
+
+Image Image::converted(types::VoxelType type) const {
+	Image ret = geometry();
+	ret.allocate(type);
+	auto fill = [this](auto* out){
+		using T = std::decay_t<decltype(*out)>;
+		visit([out, this](const auto* in){
+			for (size_t i = 0; i < size_t(nvox()); i++){
+				out[i] = types::voxel_cast<T>(types::to_float(in[i]));
+			}
+		});
+	};
+	switch (type){
+	case types::VoxelType::INT16: fill(ret.data<short>()); break;
+	case types::VoxelType::UINT8: fill(ret.data<unsigned char>()); break;
+	case types::VoxelType::FLOAT16: fill(ret.data<types::half>()); break;
+	default: fill(ret.data<float>()); break;
+	}
+	return ret;
+}
+
+
+Image Image::coarse_grid(const vector<float> &target_voxel_sizes) const {
+	//voxel boundaries of both grids coincide on the outside, so nothing is lost or gained
+	Image ret = geometry();
+	for (int i = 0; i < ndim(); i++) {
+		float extent = dim_size[i] * voxel_sizes[i];
+		float corner = min_ext[i] - voxel_sizes[i] / 2;
+		ret.dim_size[i] = std::max(1, int(std::lround(extent / target_voxel_sizes[i])));
+		ret.voxel_sizes[i] = extent / ret.dim_size[i];
+		ret.min_ext[i] = corner + ret.voxel_sizes[i] / 2;
+		ret.max_ext[i] = ret.min_ext[i] + ret.voxel_sizes[i] * (ret.dim_size[i] - 1);
+	}
+	return ret;
+}
+
+
+vector<vector<std::pair<int, float>>> Image::overlaps(const Image &to, int axis) const {
+	double vf = voxel_sizes[axis], vt = to.voxel_sizes[axis];
+	double f0 = min_ext[axis] - vf / 2, t0 = to.min_ext[axis] - vt / 2;
+	vector<vector<std::pair<int, float>>> ret(to.dim_size[axis]);
+	for (int c = 0; c < to.dim_size[axis]; c++){
+		double lo = t0 + c * vt, hi = lo + vt;
+		int first = std::max(0, int(std::floor((lo - f0) / vf)));
+		int last = std::min(dim_size[axis] - 1, int(std::floor((hi - f0) / vf)));
+		for (int f = first; f <= last; f++){
+			double flo = f0 + f * vf;
+			double overlap = std::min(hi, flo + vf) - std::max(lo, flo);
+			if (overlap > 0) ret[c].push_back({ f, float(overlap / vf) });
+		}
+	}
+	return ret;
+}
+
+
+Image Image::downsample(const vector<float> &target_voxel_sizes) const {
+	assert(ndim() == 3);
+	Image ret = coarse_grid(target_voxel_sizes);
+	auto ox = overlaps(ret, 0), oy = overlaps(ret, 1), oz = overlaps(ret, 2);
+	auto in = [this](int i, int j, int k){ return voxel(i + dim_size[0] * (j + size_t(dim_size[1]) * k)); };
+
+	vector<float> &out = ret.imdata;
+	out.resize(ret.nvox());
+	size_t i = 0;
+	for (int z = 0; z < ret.dim_size[2]; z++){
+		for (int y = 0; y < ret.dim_size[1]; y++){
+			for (int x = 0; x < ret.dim_size[0]; x++){
+				double sum = 0., weight = 0.;
+				for (const auto &fz : oz[z]) for (const auto &fy : oy[y]) for (const auto &fx : ox[x]){
+					double w = double(fx.second) * fy.second * fz.second;
+					sum += w * in(fx.first, fy.first, fz.first);
+					weight += w;
+				}
+				out[i++] = weight > 0 ? float(sum / weight) : 0.f;
+			}
+		}
+	}
+	return ret;
+}
+
+
+float Image::sample(float x, float y, float z) const {
+	assert(ndim() == 3);
+	const float pos[3] = { x, y, z };
+	int i0[3], i1[3];
+	float frac[3];
+	for (int a = 0; a < 3; a++){
+		float u = (pos[a] - min_ext[a]) / voxel_sizes[a];
+		u = std::min(std::max(u, 0.f), float(dim_size[a] - 1));
+		i0[a] = std::min(int(u), dim_size[a] - 1);
+		i1[a] = std::min(i0[a] + 1, dim_size[a] - 1);
+		frac[a] = u - i0[a];
+	}
+	auto at = [this](int i, int j, int k){ return voxel(i + dim_size[0] * (j + size_t(dim_size[1]) * k)); };
+	float c00 = at(i0[0], i0[1], i0[2]) * (1 - frac[0]) + at(i1[0], i0[1], i0[2]) * frac[0];
+	float c10 = at(i0[0], i1[1], i0[2]) * (1 - frac[0]) + at(i1[0], i1[1], i0[2]) * frac[0];
+	float c01 = at(i0[0], i0[1], i1[2]) * (1 - frac[0]) + at(i1[0], i0[1], i1[2]) * frac[0];
+	float c11 = at(i0[0], i1[1], i1[2]) * (1 - frac[0]) + at(i1[0], i1[1], i1[2]) * frac[0];
+	float c0 = c00 * (1 - frac[1]) + c10 * frac[1];
+	float c1 = c01 * (1 - frac[1]) + c11 * frac[1];
+	return c0 * (1 - frac[2]) + c1 * frac[2];
+}
+
+
+Image Image::resampled_to(const Image &grid) const {
+	assert(grid.ndim() == 3);
+	Image ret = grid.geometry();
+	vector<float> &out = ret.imdata;
+	out.resize(ret.nvox());
+	size_t i = 0;
+	for (int z = 0; z < grid.dim_size[2]; z++){
+		for (int y = 0; y < grid.dim_size[1]; y++){
+			for (int x = 0; x < grid.dim_size[0]; x++){
+				out[i++] = sample(grid.min_ext[0] + x * grid.voxel_sizes[0], grid.min_ext[1] + y * grid.voxel_sizes[1], grid.min_ext[2] + z * grid.voxel_sizes[2]);
+			}
+		}
+	}
+	return ret;
+}
+
+
+Image Image::cropped_grid(const vector<int> &first, const vector<int> &size) const {
+	Image ret = geometry();
+	for (int i = 0; i < ndim(); i++) {
+		assert(first[i] >= 0 && size[i] > 0 && first[i] + size[i] <= dim_size[i]);
+		if (first[i] == 0 && size[i] == dim_size[i]) continue; //keep the extent bit for bit
+		ret.dim_size[i] = size[i];
+		ret.min_ext[i] = min_ext[i] + first[i] * voxel_sizes[i];
+		ret.max_ext[i] = ret.min_ext[i] + voxel_sizes[i] * (size[i] - 1);
+	}
+	return ret;
+}
+
+
+Image Image::padded_to(const Image &grid, const vector<int> &first, float outside) const {
+	assert(ndim() == 3 && grid.ndim() == 3);
+	Image ret = grid.copy_with_new_voxels(vector<float>(grid.nvox(), outside));
+	size_t nx = dim_size[0], gx = grid.dim_size[0], gy = grid.dim_size[1];
+	for (int z = 0; z < dim_size[2]; z++){
+		for (int y = 0; y < dim_size[1]; y++){
+			size_t from = nx * (y + size_t(dim_size[1]) * z);
+			float* to = ret.imdata.data() + first[0] + gx * (first[1] + y + gy * (first[2] + z));
+			for (size_t x = 0; x < nx; x++) to[x] = voxel(from + x);
+		}
+	}
+	return ret;
+}
+
+
+void Image::inflate(const char* in, size_t nin, char* out, size_t nout, const std::string &fn, bool raw){
+	//zlib or gzip stream, must decode to exactly nout bytes. zlib counts in uInt, so over 4 GiB it is fed in pieces.
+	//raw deflate (a block of write_mhd) has no header, and its data ends where the block does unless it is the last.
+	const size_t piece = std::numeric_limits<uInt>::max();
+	z_stream strm = {};
+	if (inflateInit2(&strm, raw ? -15 : 15 + 32) != Z_OK) throw std::pair<int, std::string>(77, "Problem decompressing '" + fn + "'.");
+	strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in));
+	strm.next_out = reinterpret_cast<Bytef*>(out);
+	size_t in_left = nin, out_left = nout;
+	int ret = Z_OK;
+	while (ret == Z_OK){
+		if (strm.avail_in == 0 && in_left > 0){
+			strm.avail_in = static_cast<uInt>(std::min(in_left, piece));
+			in_left -= strm.avail_in;
+		}
+		if (strm.avail_out == 0 && out_left > 0){
+			strm.avail_out = static_cast<uInt>(std::min(out_left, piece));
+			out_left -= strm.avail_out;
+		}
+		ret = ::inflate(&strm, Z_NO_FLUSH); //Z_BUF_ERROR once input or output is used up before the end
+	}
+	size_t nread = nout - out_left - strm.avail_out; //not total_out, a 32 bit uLong on windows
+	inflateEnd(&strm);
+	bool ended = (ret == Z_STREAM_END) || (raw && ret == Z_BUF_ERROR);
+	if (!ended || nread != nout) throw std::pair<int, std::string>(77, "Problem decompressing '" + fn + "'.");
+}
+
+
+void Image::write(const std::string &fname, bool compress) const {
 	if (pystring::endswith(fname, ".xdr")){
 		write_xdr(fname);
 	}
 	else if (pystring::endswith(fname, ".mhd")){
-		write_mhd(fname);
+		write_mhd(fname, compress);
 	}
 	else {
 		printf("Unkown file extension encountered, aborting write out...");
@@ -61,36 +505,56 @@ void Image::write(const std::string &fname){
 }
 
 
-void Image::read_xdr(const std::string &xdrfile) {
-	//Phantom phantom;
-
-	auto xdr = fromfile<char>(xdrfile);
+ImageInfo Image::probe_xdr(const std::string &xdrfile) {
+	FILE* ffile = fopen(xdrfile.c_str(), "rb");
+	if (ffile == nullptr){
+		throw std::pair<int, std::string>(72, "Problem reading file '" + xdrfile + "'.");
+	}
+	io::seek(ffile, 0, SEEK_END);
+	int64_t fsize = io::tell(ffile);
+	rewind(ffile);
 
 	std::string header;
 
-	//calc offset of magic bytes
+	//read small prefixes until we find the magic bytes, the rest of the file is not touched yet
+	char prefix[4096];
 	char lasti = ' ';
-	long imdata_offset = 0;
-	for (char i : xdr){
-		imdata_offset++;
-		if (i == 0x0c && lasti == 0x0c){
-			break;
+	int64_t imdata_offset = 0;
+	bool found_magic = false;
+	while (!found_magic){
+		size_t n = fread(prefix, sizeof(char), sizeof(prefix), ffile);
+		if (n == 0) break;
+		for (size_t j = 0; j < n; j++){
+			char i = prefix[j];
+			imdata_offset++;
+			if (i == 0x0c && lasti == 0x0c){
+				found_magic = true;
+				break;
+			}
+			lasti = i;
+			header += i;
 		}
-		lasti = i;
-		header += i;
+	}
+	if (!found_magic){
+		fclose(ffile);
+		throw std::pair<int, std::string>(76, "No header found in '" + xdrfile + "'.");
 	}
 	header.pop_back(); //one magic byte was added.
 
-	int type = -1; //2 = >i2, 4 = >f4
+	ImageInfo info;
+	info.datafile = xdrfile;
+	info.offset = imdata_offset;
+	info.big_endian = true;
+	int type = -1; //1 = >u1, 2 = >i2, 4 = >f4
 
 	for (const auto &line : parse::parse_dump(header)){
 		if (startswith(line.first, "ndim")) {
 			int _ndim = stoi(line.second);
 			assert(_ndim > 0 && _ndim < 4);
-			dim_size.resize(_ndim);
-			voxel_sizes.resize(_ndim);
-			min_ext.resize(_ndim);
-			max_ext.resize(_ndim);
+			info.dim_size.resize(_ndim);
+			info.voxel_sizes.resize(_ndim);
+			info.min_ext.resize(_ndim);
+			info.max_ext.resize(_ndim);
 			continue;
 		}
 		if (startswith(line.first, "field")) {
@@ -100,9 +564,15 @@ void Image::read_xdr(const std::string &xdrfile) {
 		if (startswith(line.first, "data")) {
 			if (startswith(line.second, "xdr_short")){
 				type = 2;
+				info.type = types::VoxelType::INT16;
+			}
+			else if (startswith(line.second, "xdr_byte")){
+				type = 1;
+				info.type = types::VoxelType::UINT8;
 			}
 			else if (startswith(line.second, "xdr_real") || startswith(line.second, "xdr_float")){
 				type = 4;
+				info.type = types::VoxelType::FLOAT32;
 			}
 			else{
 				assert(type != -1); //blow up
@@ -110,15 +580,15 @@ void Image::read_xdr(const std::string &xdrfile) {
 			continue;
 		}
 		if (startswith(line.first, "dim1")) {
-			dim_size[0] = stoi(line.second);
+			info.dim_size[0] = stoi(line.second);
 			continue;
 		}
 		if (startswith(line.first, "dim2")) {
-			dim_size[1] = stoi(line.second);
+			info.dim_size[1] = stoi(line.second);
 			continue;
 		}
 		if (startswith(line.first, "dim3")) {
-			dim_size[2] = stoi(line.second);
+			info.dim_size[2] = stoi(line.second);
 			continue;
 		}
 		/*if (startswith(line.first, "min_ext")) {
@@ -137,43 +607,74 @@ void Image::read_xdr(const std::string &xdrfile) {
 
 	//header loaded.
 
-	long imdata_bytes = nvox()*type;
-	long ext_offset = imdata_offset + imdata_bytes;
-	long ext_bytes = ndim() * 2 * sizeof(float);
+	int64_t imdata_bytes = info.nbytes();
+	int64_t ext_offset = imdata_offset + imdata_bytes;
+	int64_t ext_bytes = info.ndim() * 2 * sizeof(float);
 
 	//check that the size of the .xdr corresponds to the header+voxels*voxeltype+exts:
-	assert(xdr.size() == imdata_offset + imdata_bytes + ext_bytes);
-
-	vector<char> _imdata(xdr.begin() + imdata_offset, xdr.begin() + imdata_offset + imdata_bytes);
+	assert(fsize == imdata_offset + imdata_bytes + ext_bytes);
 
-	if (type == 2){
-		types::swap_endianness<short>(_imdata);
-		vector<short> shorts = types::reinterpret<short>(_imdata);
-		imdata.insert(imdata.begin(), shorts.begin(), shorts.end()); //this upcasts shorts
-	}
-	else if (type == 4){
-		types::swap_endianness<float>(_imdata);
-		imdata = types::reinterpret<float>(_imdata);
-	}
-
-	//now the extents in the final ndim*2*sizeof(float) bytes
-	//write extents, looped pairwise over axis
+	//the extents are in the final ndim*2*sizeof(float) bytes, pairwise over axis
 	//xmin, xmax, ymin, ymax, zmin, zmax
+	vector<float> exts(info.ndim() * 2);
+	io::seek(ffile, ext_offset, SEEK_SET);
+	fread(exts.data(), sizeof(char), ext_bytes, ffile);
+	fclose(ffile);
+	types::swap_endianness<float>(reinterpret_cast<char*>(exts.data()), ext_bytes);
 
-	vector<char> _exts(xdr.begin() + ext_offset, xdr.begin() + ext_offset + ext_bytes);
-	types::swap_endianness<float>(_exts);
-	vector<float> exts = types::reinterpret<float>(_exts);
-
-	for (size_t i = 0; i < ndim(); i++) {
-		min_ext[i] = exts[2 * i];
-		max_ext[i] = exts[2 * i + 1];
+	for (size_t i = 0; i < info.ndim(); i++) {
+		info.min_ext[i] = exts[2 * i];
+		info.max_ext[i] = exts[2 * i + 1];
 		//calc binsize
-		voxel_sizes[i] = (max_ext[i] - min_ext[i]) / (dim_size[i] - 1);
+		info.voxel_sizes[i] = (info.max_ext[i] - info.min_ext[i]) / (info.dim_size[i] - 1);
 	}
+	return info;
 }
 
 
-void Image::write_mhd(const std::string &fn){
+void Image::write_mhd(const std::string &fn, bool compress) const {
+	//compressed: deflate all blocks in parallel first, their sizes go in the header.
+	//the blocks are raw deflate, each ended byte aligned with a sync flush and the last with the final block, so together
+	//behind a zlib header and the combined adler32 they are one standard zlib stream, which ITK and Slicer read whole.
+	vector<vector<char>> blocks;
+	vector<uLong> checks;
+	vector<size_t> block_bytes;
+	if (compress){
+		//halfs go out as floats, so only they need a converted copy. other types are deflated in place.
+		Image as_floats;
+		const Image* source = this;
+		if (vtype == types::VoxelType::FLOAT16){
+			as_floats = converted(types::VoxelType::FLOAT32);
+			source = &as_floats;
+		}
+		const char* raw = source->bytes();
+		size_t nbytes = nvox() * types::voxel_size(source->type());
+		blocks.resize(std::max<size_t>(1, (nbytes + zraw_block_bytes - 1) / zraw_block_bytes));
+		checks.resize(blocks.size());
+		block_bytes.resize(blocks.size());
+		threads::parallel_for(blocks.size(), [&](size_t b){
+			const bool last = (b + 1 == blocks.size());
+			size_t n = std::min(zraw_block_bytes, nbytes - b * zraw_block_bytes);
+			const Bytef* in = reinterpret_cast<const Bytef*>(raw + b * zraw_block_bytes);
+			z_stream strm = {};
+			if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK){
+				throw std::pair<int, std::string>(78, "Problem compressing '" + fn + "'.");
+			}
+			blocks[b].resize(deflateBound(&strm, uLong(n)) + 16); //and the sync flush marker
+			strm.next_in = const_cast<Bytef*>(in);
+			strm.avail_in = uInt(n);
+			strm.next_out = reinterpret_cast<Bytef*>(blocks[b].data());
+			strm.avail_out = uInt(blocks[b].size());
+			int ret = deflate(&strm, last ? Z_FINISH : Z_SYNC_FLUSH);
+			bool ok = last ? (ret == Z_STREAM_END) : (ret == Z_OK && strm.avail_in == 0 && strm.avail_out > 0);
+			blocks[b].resize(blocks[b].size() - strm.avail_out);
+			deflateEnd(&strm);
+			if (!ok) throw std::pair<int, std::string>(78, "Problem compressing '" + fn + "'.");
+			checks[b] = adler32_z(adler32_z(0, nullptr, 0), in, n);
+			block_bytes[b] = n;
+		});
+	}
+
 	FILE* ffile = fopen(fn.c_str(), "wb");
 	if (ffile == nullptr){
 		throw std::pair<int, std::string>(70, "Problem writing file '" + fn + "'.");
@@ -183,7 +684,21 @@ void Image::write_mhd(const std::string &fn){
 	fprintf(ffile, "NDims=%i\n", ndim());
 	fprintf(ffile, "BinaryData = True\n");
 	fprintf(ffile, "BinaryDataByteOrderMSB = False\n");
-	fprintf(ffile, "CompressedData = False\n");
+	if (compress){
+		size_t offset = 2; //the zlib header
+		std::string offsets;
+		for (const auto &b : blocks){
+			offsets += std::to_string(offset) + " ";
+			offset += b.size();
+		}
+		fprintf(ffile, "CompressedData = True\n");
+		fprintf(ffile, "CompressedDataSize = %zu\n", offset + 4); //and the adler32
+		fprintf(ffile, "CompressedDataBlockSize = %zu\n", zraw_block_bytes);
+		fprintf(ffile, "CompressedDataBlockOffsets = %s\n", offsets.c_str());
+	}
+	else {
+		fprintf(ffile, "CompressedData = False\n");
+	}
 	fprintf(ffile, "Offset = ");
 	for (int i = 0; i < ndim(); i++) {
 		fprintf(ffile, "%f ", min_ext[i]*10);
@@ -199,20 +714,51 @@ void Image::write_mhd(const std::string &fn){
 		fprintf(ffile, "%i ", dim_size[i]);
 	}
 	fprintf(ffile, "\n");
-	fprintf(ffile, "ElementType = MET_FLOAT\n");
+	if (vtype == types::VoxelType::INT16) fprintf(ffile, "ElementType = MET_SHORT\n");
+	else if (vtype == types::VoxelType::UINT8) fprintf(ffile, "ElementType = MET_UCHAR\n");
+	else fprintf(ffile, "ElementType = MET_FLOAT\n"); //halfs are written as floats
 	std::string rawfile;
 	std::string ext;
 	os::path::splitext(rawfile,ext,fn);
-	rawfile += ".raw";
+	rawfile += compress ? ".zraw" : ".raw";
 	fprintf(ffile, "ElementDataFile = %s\n",rawfile.c_str());
 	fclose(ffile);
 
 	//write rawfile
-	tofile<float>(imdata,rawfile);
+	FILE* rfile = fopen(rawfile.c_str(), "wb");
+	if (rfile == nullptr){
+		throw std::pair<int, std::string>(70, "Problem writing file '" + rawfile + "'.");
+	}
+	if (compress){
+		const unsigned char header[2] = { 0x78, 0x9c }; //deflate, 32k window, default level
+		fwrite(header, 1, 2, rfile);
+		uLong check = checks[0];
+		for (size_t b = 0; b < blocks.size(); b++){
+			fwrite(blocks[b].data(), sizeof(char), blocks[b].size(), rfile);
+			if (b > 0) check = adler32_combine(check, checks[b], z_off_t(block_bytes[b]));
+		}
+		const unsigned char trailer[4] = { uint8_t(check >> 24), uint8_t(check >> 16), uint8_t(check >> 8), uint8_t(check) }; //big endian
+		fwrite(trailer, 1, 4, rfile);
+	}
+	else if (vtype == types::VoxelType::FLOAT16){
+		vector<float> block(io_block_bytes / sizeof(float));
+		const types::half* halfs = data<types::half>();
+		for (size_t first = 0; first < size_t(nvox()); first += block.size()){
+			size_t n = std::min(block.size(), nvox() - first);
+			for (size_t i = 0; i < n; i++){
+				block[i] = types::half_to_float(halfs[first + i]);
+			}
+			fwrite(block.data(), sizeof(float), n, rfile);
+		}
+	}
+	else {
+		fwrite(bytes(), types::voxel_size(vtype), nvox(), rfile);
+	}
+	fclose(rfile);
 }
 
 
-void Image::write_xdr(const std::string &fn){
+void Image::write_xdr(const std::string &fn) const {
     FILE* ffile = fopen(fn.c_str(), "wb");
     if (ffile == nullptr){
         throw std::pair<int, std::string>(70, "Problem writing file '" + fn + "'.");
@@ -224,14 +770,33 @@ void Image::write_xdr(const std::string &fn){
     }
     fprintf(ffile, "nspace=%i\n",ndim()); //dont know if used
     fprintf(ffile, "veclen=1\n"); //dont know if used
-    fprintf(ffile, "data=xdr_real\n"); //dont know if used
+	if (vtype == types::VoxelType::INT16) fprintf(ffile, "data=xdr_short\n");
+	else if (vtype == types::VoxelType::UINT8) fprintf(ffile, "data=xdr_byte\n");
+	else fprintf(ffile, "data=xdr_real\n"); //halfs are written as floats
     fprintf(ffile, "field=uniform\n"); //dont know if used
     fprintf(ffile, "%c%c",0x0c,0x0c); //magic bytes
 
-    //convert imdata to bytes
-	vector<char> imdata_swapped = types::reinterpret<char>(imdata);
-	types::swap_endianness<float>(imdata_swapped);
-    fwrite(imdata_swapped.data(), sizeof(char), imdata_swapped.size(), ffile);
+	//swap voxels through a small buffer
+	vector<char> block(io_block_bytes);
+	size_t out_size = (vtype == types::VoxelType::FLOAT16) ? sizeof(float) : types::voxel_size(vtype);
+	size_t block_nvox = io_block_bytes / out_size;
+	for (size_t first = 0; first < size_t(nvox()); first += block_nvox){
+		size_t n = std::min(block_nvox, nvox() - first);
+		switch (vtype){
+		case types::VoxelType::INT16: simd::swap16(data<short>() + first, block.data(), n); break;
+		case types::VoxelType::UINT8: std::memcpy(block.data(), data<unsigned char>() + first, n); break;
+		case types::VoxelType::FLOAT16: {
+			float* f = reinterpret_cast<float*>(block.data());
+			for (size_t i = 0; i < n; i++){
+				f[i] = types::half_to_float(data<types::half>()[first + i]);
+			}
+			simd::swap32(f, f, n);
+			break;
+		}
+		default: simd::swap32(data<float>() + first, block.data(), n); break;
+		}
+		fwrite(block.data(), out_size, n, ffile);
+	}
 
 	//extents
 	//xmin, xmax, ymin, ymax, zmin, zmax
@@ -247,17 +812,17 @@ void Image::write_xdr(const std::string &fn){
 }
 
 
-void Image::read_mhd(const std::string &header) {
-	std::string rawfile;
-	int type = -1; //2 = >i2, 4 = >f4
+ImageInfo Image::probe_mhd(const std::string &header) {
+	ImageInfo info;
+	int type = -1; //1 = <u1, 2 = <i2, 4 = <f4
 	for (const auto &line : parse::load_dump(header)) {
 		if (startswith(line.first, "NDims")) {
 			int _ndim = stoi(line.second);
 			assert(_ndim > 0 && _ndim < 4);
-			dim_size.resize(_ndim);
-			voxel_sizes.resize(_ndim);
-			min_ext.resize(_ndim);
-			max_ext.resize(_ndim);
+			info.dim_size.resize(_ndim);
+			info.voxel_sizes.resize(_ndim);
+			info.min_ext.resize(_ndim);
+			info.max_ext.resize(_ndim);
 			continue;
 		}
 		if (startswith(line.first, "BinaryData") && !startswith(line.first, "BinaryDataByteOrderMSB")) {
@@ -268,38 +833,56 @@ void Image::read_mhd(const std::string &header) {
 			assert(startswith(line.second, "False"));
 			continue;
 		}
-		if (startswith(line.first, "CompressedData")) {
-			assert(startswith(line.second, "False"));
+		if (line.first == "CompressedData") {
+			info.compressed = startswith(line.second, "True");
+			continue;
+		}
+		if (line.first == "CompressedDataSize") {
+			info.compressed_size = types::lexical_cast<unsigned long long>(line.second);
+			continue;
+		}
+		if (line.first == "CompressedDataBlockSize") {
+			info.block_size = types::lexical_cast<unsigned long long>(line.second);
+			continue;
+		}
+		if (line.first == "CompressedDataBlockOffsets") {
+			for (auto o : types::split<unsigned long long>(line.second)) info.block_offsets.push_back(o);
 			continue;
 		}
 		if (startswith(line.first, "ElementSpacing")) {
-			voxel_sizes = types::split<float>(line.second);
-			for (auto &i : voxel_sizes){
+			info.voxel_sizes = types::split<float>(line.second);
+			for (auto &i : info.voxel_sizes){
 				i /= 10;
 			}
 			continue;
 		}
 		if (startswith(line.first, "DimSize")) {
-			dim_size = types::split<int>(line.second);
+			info.dim_size = types::split<int>(line.second);
 			continue;
 		}
 		if (startswith(line.first, "Offset")) {
-			min_ext = types::split<float>(line.second);
-			for (auto &i : min_ext){
+			info.min_ext = types::split<float>(line.second);
+			for (auto &i : info.min_ext){
 				i /= 10;
 			}
 			continue;
 		}
 		if (startswith(line.first, "ElementDataFile")) {
-			rawfile = line.second;
+			info.datafile = line.second;
 			continue;
 		}
 		if (startswith(line.first, "ElementType")) {
 			if (startswith(line.second, "MET_SHORT")){
 				type = 2;
+				info.type = types::VoxelType::INT16;
+			}
+			else if (startswith(line.second, "MET_UCHAR")){
+				type = 1;
+				info.type = types::VoxelType::UINT8;
 			}
 			else if (startswith(line.second, "MET_FLOAT")){
 				type = 4;
+				info.type = types::VoxelType::FLOAT32;
 			}
 			else{
 				assert(type != -1); //blow up
@@ -308,16 +891,115 @@ void Image::read_mhd(const std::string &header) {
 		}
 	}
 
-	if (type == 2){
-		vector<short> shorts = fromfile<short>(rawfile);
-		imdata.insert(imdata.begin(), shorts.begin(), shorts.end());
+	info.max_ext.resize(info.ndim());
+	for (size_t i = 0; i < info.ndim(); i++) {
+		info.max_ext[i] = info.min_ext[i] + info.voxel_sizes[i] * (info.dim_size[i] -1);
 	}
-	else if (type == 4){
-		imdata = fromfile<float>(rawfile);
+	return info;
+}
+
+
+void Image::read(const ImageInfo &info, ImageLoad load) {
+	dim_size = info.dim_size;
+	voxel_sizes = info.voxel_sizes;
+	min_ext = info.min_ext;
+	max_ext = info.max_ext;
+	const types::VoxelType ftype = info.type;
+	const size_t nbytes = info.nbytes();
+
+	//raw is little endian, as is any host we run on. xdr is big endian.
+	if (info.compressed){
+		//decode straight into native storage, blocks in parallel
+		io::mmap_file zraw(info.datafile);
+		size_t compressed_size = info.compressed_size > 0 ? info.compressed_size : zraw.size();
+		assert(compressed_size <= zraw.size());
+		allocate(ftype);
+		char* dest = owned_bytes();
+		if (info.block_size > 0 && !info.block_offsets.empty()){
+			//blocks of one stream end in the adler32 of all of them, checked here as zlib would at the end of the stream
+			const bool one_stream = info.blocks_in_one_stream();
+			if (one_stream && compressed_size < 4) throw std::pair<int, std::string>(77, "Problem decompressing '" + info.datafile + "'.");
+			vector<size_t> block_offsets = info.block_offsets;
+			assert(block_offsets.size() == std::max<size_t>(1, (nbytes + info.block_size - 1) / info.block_size));
+			block_offsets.push_back(one_stream ? compressed_size - 4 : compressed_size);
+			vector<uLong> checks(block_offsets.size() - 1);
+			threads::parallel_for(block_offsets.size() - 1, [&](size_t b){
+				size_t n = std::min(info.block_size, nbytes - b * info.block_size);
+				inflate(zraw.data() + block_offsets[b], block_offsets[b + 1] - block_offsets[b], dest + b * info.block_size, n, info.datafile, one_stream);
+				if (one_stream) checks[b] = adler32_z(adler32_z(0, nullptr, 0), reinterpret_cast<const Bytef*>(dest + b * info.block_size), n);
+			});
+			if (one_stream){
+				uLong check = checks[0];
+				for (size_t b = 1; b < checks.size(); b++){
+					check = adler32_combine(check, checks[b], z_off_t(std::min(info.block_size, nbytes - b * info.block_size)));
+				}
+				const unsigned char* trailer = reinterpret_cast<const unsigned char*>(zraw.data() + compressed_size - 4);
+				uLong stored = (uLong(trailer[0]) << 24) | (uLong(trailer[1]) << 16) | (uLong(trailer[2]) << 8) | uLong(trailer[3]);
+				if (check != stored) throw std::pair<int, std::string>(77, "Problem decompressing '" + info.datafile + "', checksum mismatch.");
+			}
+		}
+		else {
+			inflate(zraw.data(), compressed_size, dest, nbytes, info.datafile);
+		}
+		if (load == ImageLoad::FLOAT) floats();
+		return;
 	}
-	assert(imdata.size() == nvox());
 
-	for (size_t i = 0; i < ndim(); i++) {
-		max_ext[i] = min_ext[i] + voxel_sizes[i] * (dim_size[i] -1);
+	if (load == ImageLoad::MAPPED && !info.big_endian){
+		mapping = std::make_shared<io::mmap_file>(info.datafile);
+		vtype = ftype;
+		assert(info.offset == 0 && mapping->size() == nbytes);
+		return;
+	}
+
+	FILE* ffile = fopen(info.datafile.c_str(), "rb");
+	if (ffile == nullptr){
+		throw std::pair<int, std::string>(72, "Problem reading file '" + info.datafile + "'.");
 	}
+	io::seek(ffile, int64_t(info.offset), SEEK_SET);
+
+	//decode voxels block by block straight into their storage, which load() may have allocated already
+	allocate(load == ImageLoad::FLOAT ? types::VoxelType::FLOAT32 : ftype);
+	if (vtype == ftype){
+		//read in place, swapped while still in cache
+		char* dest = owned_bytes();
+		for (size_t first = 0; first < nbytes; first += io_block_bytes){
+			size_t n = std::min(io_block_bytes, nbytes - first);
+			if (fread(dest + first, sizeof(char), n, ffile) != n){
+				fclose(ffile);
+				throw std::pair<int, std::string>(72, "Problem reading file '" + info.datafile + "'.");
+			}
+			if (!info.big_endian) continue;
+			if (ftype == types::VoxelType::INT16) simd::swap16(dest + first, dest + first, n / 2);
+			if (ftype == types::VoxelType::FLOAT32) simd::swap32(dest + first, dest + first, n / 4);
+		}
+	}
+	else {
+		//upcast to float
+		size_t fsize = types::voxel_size(ftype);
+		vector<char> block(io_block_bytes);
+		size_t block_nvox = io_block_bytes / fsize;
+		for (size_t first = 0; first < imdata.size(); first += block_nvox){
+			size_t n = std::min(block_nvox, imdata.size() - first);
+			if (fread(block.data(), fsize, n, ffile) != n){
+				fclose(ffile);
+				throw std::pair<int, std::string>(72, "Problem reading file '" + info.datafile + "'.");
+			}
+			if (ftype == types::VoxelType::INT16 && info.big_endian){
+				simd::be_i16_to_f32(block.data(), &imdata[first], n);
+			}
+			else if (ftype == types::VoxelType::INT16){
+				const short* shorts = reinterpret_cast<const short*>(block.data());
+				for (size_t i = 0; i < n; i++){
+					imdata[first + i] = shorts[i];
+				}
+			}
+			else {
+				for (size_t i = 0; i < n; i++){
+					imdata[first + i] = static_cast<unsigned char>(block[i]);
+				}
+			}
+		}
+	}
+	fclose(ffile);
 }
\ No newline at end of file
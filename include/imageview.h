@@ -0,0 +1,162 @@
+#pragma once
+
+#include <array>
+#include <cstddef> //size_t
+#include <iterator>
+#include <type_traits> //std::remove_const_t
+#include <assert.h>
+
+/*
+ * Non-owning view on voxels, with the dimensionality known at compile time.
+ * Axis 0 (x) runs fastest, as in Image. Slices, rows and boxes are views too, nothing is copied.
+ */
+
+template <typename T, size_t N>
+class ImageView;
+
+template <typename T>
+class StridedIterator {
+public:
+	using iterator_category = std::random_access_iterator_tag;
+	using value_type = std::remove_const_t<T>;
+	using difference_type = std::ptrdiff_t;
+	using pointer = T*;
+	using reference = T&;
+
+	StridedIterator() = default;
+	StridedIterator(T* _p, std::ptrdiff_t _stride) : p(_p), stride(_stride){};
+
+	T &operator*() const { return *p; };
+	T* operator->() const { return p; };
+	T &operator[](difference_type n) const { return p[n * stride]; };
+	StridedIterator &operator++(){ p += stride; return *this; };
+	StridedIterator operator++(int){ auto r = *this; p += stride; return r; };
+	StridedIterator &operator--(){ p -= stride; return *this; };
+	StridedIterator operator--(int){ auto r = *this; p -= stride; return r; };
+	StridedIterator &operator+=(difference_type n){ p += n * stride; return *this; };
+	StridedIterator &operator-=(difference_type n){ p -= n * stride; return *this; };
+	StridedIterator operator+(difference_type n) const { return StridedIterator(p + n * stride, stride); };
+	friend StridedIterator operator+(difference_type n, const StridedIterator &it){ return it + n; };
+	StridedIterator operator-(difference_type n) const { return StridedIterator(p - n * stride, stride); };
+	difference_type operator-(const StridedIterator &o) const { return (p - o.p) / stride; };
+	bool operator==(const StridedIterator &o) const { return p == o.p; };
+	bool operator!=(const StridedIterator &o) const { return p != o.p; };
+	bool operator<(const StridedIterator &o) const { return (p - o.p) * stride < 0; }; //strides may be negative
+	bool operator>(const StridedIterator &o) const { return o < *this; };
+	bool operator<=(const StridedIterator &o) const { return !(o < *this); };
+	bool operator>=(const StridedIterator &o) const { return !(*this < o); };
+
+private:
+	T* p = nullptr;
+	std::ptrdiff_t stride = 1;
+};
+
+
+template <typename T, size_t N>
+class ImageView {
+	static_assert(N > 0, "ImageView needs at least one axis");
+public:
+	using index_t = std::array<size_t, N>;
+
+	constexpr ImageView(T* _ptr, const index_t &_dims) : ptr(_ptr), dims(_dims), strides(contiguous_strides(_dims)){};
+	constexpr ImageView(T* _ptr, const index_t &_dims, const index_t &_strides) : ptr(_ptr), dims(_dims), strides(_strides){};
+
+	constexpr T* data() const { return ptr; };
+	constexpr size_t size(size_t axis) const { return dims[axis]; };
+	constexpr size_t stride(size_t axis) const { return strides[axis]; };
+	constexpr const index_t &shape() const { return dims; };
+	constexpr size_t nvox() const {
+		size_t n = 1;
+		for (size_t a = 0; a < N; a++) n *= dims[a];
+		return n;
+	};
+	constexpr bool contiguous() const { return strides == contiguous_strides(dims); };
+
+	// (i,j,k) -> offset from data()
+	template <typename... I>
+	constexpr size_t index(I... idx) const {
+		static_assert(sizeof...(I) == N, "need one index per axis");
+		const size_t ids[N] = { static_cast<size_t>(idx)... };
+		size_t r = 0;
+		for (size_t a = 0; a < N; a++) r += ids[a] * strides[a];
+		return r;
+	};
+
+	template <typename... I>
+	constexpr T &operator()(I... idx) const { return ptr[index(idx...)]; };
+
+	// plane (or row, for 2D) at position i of the slowest axis, e.g. slice z=i of a 3D image
+	ImageView<T, N - 1> slice(size_t i) const {
+		static_assert(N > 1, "cant slice a row");
+		assert(i < dims[N - 1]);
+		std::array<size_t, N - 1> d, s;
+		for (size_t a = 0; a < N - 1; a++){
+			d[a] = dims[a];
+			s[a] = strides[a];
+		}
+		return ImageView<T, N - 1>(ptr + i * strides[N - 1], d, s);
+	};
+
+	// 1D profile along axis, through the voxel at 'at' (its coordinate along axis is ignored)
+	ImageView<T, 1> line(size_t axis, index_t at) const {
+		at[axis] = 0;
+		size_t offset = 0;
+		for (size_t a = 0; a < N; a++) offset += at[a] * strides[a];
+		return ImageView<T, 1>(ptr + offset, { dims[axis] }, { strides[axis] });
+	};
+
+	// x row through (j,k): contiguous for images, so loops over it vectorize
+	template <typename... I>
+	ImageView<T, 1> row(I... idx) const {
+		static_assert(sizeof...(I) == N - 1, "need one index per axis except x");
+		return line(0, index_t{ size_t(0), static_cast<size_t>(idx)... });
+	};
+
+	// sub box [lo, hi)
+	ImageView<T, N> box(const index_t &lo, const index_t &hi) const {
+		index_t d;
+		size_t offset = 0;
+		for (size_t a = 0; a < N; a++){
+			assert(lo[a] <= hi[a] && hi[a] <= dims[a]);
+			d[a] = hi[a] - lo[a];
+			offset += lo[a] * strides[a];
+		}
+		return ImageView<T, N>(ptr + offset, d, strides);
+	};
+
+	// f(T* row, size_t n) for every x row, rows are contiguous when stride(0) == 1
+	template <typename F>
+	void for_each_row(F &&f) const {
+		size_t nrows = dims[0] ? nvox() / dims[0] : 0;
+		for (size_t r = 0; r < nrows; r++){
+			size_t offset = 0, rest = r;
+			for (size_t a = 1; a < N; a++){
+				offset += (rest % dims[a]) * strides[a];
+				rest /= dims[a];
+			}
+			f(ptr + offset, dims[0]);
+		}
+	};
+
+	// only 1D views iterate element wise
+	StridedIterator<T> begin() const {
+		static_assert(N == 1, "iterate rows with for_each_row");
+		return StridedIterator<T>(ptr, strides[0]);
+	};
+	StridedIterator<T> end() const {
+		static_assert(N == 1, "iterate rows with for_each_row");
+		return StridedIterator<T>(ptr + dims[0] * strides[0], strides[0]);
+	};
+
+private:
+	T* ptr;
+	index_t dims;
+	index_t strides;
+
+	static constexpr index_t contiguous_strides(const index_t &d){
+		index_t s{};
+		s[0] = 1;
+		for (size_t a = 1; a < N; a++) s[a] = s[a - 1] * d[a - 1];
+		return s;
+	};
+};
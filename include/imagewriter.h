@@ -0,0 +1,135 @@
+#pragma once
+
+#include <deque>
+#include <future>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+#include <iostream> //std::cerr
+#include "image.h"
+
+/*
+ * Writes images on a background thread. write() takes ownership of the image and returns at once,
+ * unless the queue is full, which bounds the memory held by images waiting for the disk.
+ * Errors of Image::write come back through the returned future, and the first one is also kept for flush(),
+ * so it is not lost when a caller drops the future. one nobody collected is printed when the writer is destroyed.
+ */
+
+class AsyncImageWriter {
+public:
+	AsyncImageWriter(size_t = 4); //max nr of queued images
+	~AsyncImageWriter(); //writes whatever is still queued, then joins
+	AsyncImageWriter(const AsyncImageWriter &) = delete;
+	AsyncImageWriter &operator=(const AsyncImageWriter &) = delete;
+
+	std::future<void> write(Image &&, const std::string &, bool = false); //image, fname, compress (.mhd only)
+	void flush(); //returns when everything queued so far is on disk. rethrows the first write error since the last flush.
+
+	static AsyncImageWriter &global(); //shared by all callers, joined at exit
+
+private:
+	struct Job {
+		Image image;
+		std::string fname;
+		bool compress;
+		std::promise<void> done;
+	};
+
+	size_t max_queued;
+	std::deque<Job> jobs;
+	bool busy = false; //a job was taken from the queue but is still being written
+	bool stopping = false;
+	std::exception_ptr error; //first failed write since the last flush()
+	std::mutex jobs_mutex;
+	std::condition_variable jobs_cv; //signals queue state changes in both directions
+	std::thread worker;
+
+	void run();
+};
+
+
+AsyncImageWriter::AsyncImageWriter(size_t _max_queued) : max_queued(std::max<size_t>(_max_queued, 1)){
+	worker = std::thread(&AsyncImageWriter::run, this);
+}
+
+
+AsyncImageWriter::~AsyncImageWriter(){
+	{
+		std::lock_guard<std::mutex> lock(jobs_mutex);
+		stopping = true;
+	}
+	jobs_cv.notify_all();
+	worker.join();
+	if (!error) return;
+	try {
+		std::rethrow_exception(error);
+	}
+	catch (const std::pair<int, std::string> &e) {
+		std::cerr << "Background image write failed: " << e.second << "\n";
+	}
+	catch (const std::exception &e) {
+		std::cerr << "Background image write failed: " << e.what() << "\n";
+	}
+	catch (...) {
+		std::cerr << "Background image write failed.\n";
+	}
+}
+
+
+AsyncImageWriter &AsyncImageWriter::global(){
+	static AsyncImageWriter writer;
+	return writer;
+}
+
+
+std::future<void> AsyncImageWriter::write(Image &&image, const std::string &fname, bool compress){
+	std::unique_lock<std::mutex> lock(jobs_mutex);
+	jobs_cv.wait(lock, [this]{ return jobs.size() < max_queued; });
+	jobs.push_back(Job{ std::move(image), fname, compress, std::promise<void>() });
+	std::future<void> ret = jobs.back().done.get_future();
+	lock.unlock();
+	jobs_cv.notify_all();
+	return ret;
+}
+
+
+void AsyncImageWriter::flush(){
+	std::unique_lock<std::mutex> lock(jobs_mutex);
+	jobs_cv.wait(lock, [this]{ return jobs.empty() && !busy; });
+	std::exception_ptr first = std::move(error);
+	error = nullptr;
+	lock.unlock();
+	if (first) std::rethrow_exception(first);
+}
+
+
+void AsyncImageWriter::run(){
+	while (true){
+		std::unique_lock<std::mutex> lock(jobs_mutex);
+		jobs_cv.wait(lock, [this]{ return stopping || !jobs.empty(); });
+		if (jobs.empty()) return; //stopping and nothing left
+		Job job = std::move(jobs.front());
+		jobs.pop_front();
+		busy = true;
+		lock.unlock();
+		jobs_cv.notify_all(); //room in the queue
+
+		try {
+			job.image.write(job.fname, job.compress);
+			job.done.set_value();
+		}
+		catch (...) {
+			job.done.set_exception(std::current_exception());
+			lock.lock();
+			if (!error) error = std::current_exception();
+			lock.unlock();
+		}
+		job.image = Image(); //free the voxels before reporting idle
+
+		lock.lock();
+		busy = false;
+		lock.unlock();
+		jobs_cv.notify_all();
+	}
+}
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstring> //std::memcpy
+#include <filesystem>
+#include <thread>
+#include <algorithm>
+#ifdef _WIN32
+#include <process.h> //_getpid
+#else
+#include <unistd.h> //getpid
+#endif
+#include "tools.h" //io::mmap_file, io::hash64, io::tell
+#include "gpumcd/Phantom.h"
+
+/*
+ * Phantoms on disk, one file per key (see CT::phantom_key()), so repeated CT constructions skip the conversion.
+ * A file is a fixed header, the density and medium arrays at 64 byte aligned offsets, then the material names.
+ * Files are written under a temporary name unique to the process and thread, created exclusively, and renamed,
+ * so concurrent runs never see half a file.
+ * Least recently used files (by mtime, touched on every hit) are removed once the directory exceeds max_bytes.
+ */
+
+class PhantomCache {
+public:
+	PhantomCache(const std::string &, size_t); //directory, max_bytes
+
+	bool load(uint64_t, Phantom &, std::vector<std::string> &) const; //key. false on a miss or an unusable file.
+	bool store(uint64_t, const Phantom &, const std::vector<std::string> &) const; //false when it could not be written
+	std::string path(uint64_t) const;
+
+private:
+	std::string dir;
+	size_t max_bytes;
+
+	static constexpr char magic[8] = { 'P', 'H', 'A', 'N', 'T', 'O', 'M', '1' };
+	static constexpr size_t alignment = 64;
+
+	struct Header {
+		char magic[8];
+		uint64_t key;
+		int32_t num_voxels[3];
+		float voxel_sizes[3];
+		float phantom_corner[3];
+		uint32_t pad;
+		uint64_t nvox;
+		uint64_t density_offset;
+		uint64_t medium_offset;
+		uint64_t materials_offset;
+		uint64_t materials_bytes;
+	};
+
+	static size_t aligned(size_t o){ return (o + alignment - 1) / alignment * alignment; };
+	void trim() const;
+};
+
+
+PhantomCache::PhantomCache(const std::string &_dir, size_t _max_bytes) : dir(_dir), max_bytes(_max_bytes){
+	std::error_code ec;
+	if (!dir.empty()) std::filesystem::create_directories(dir, ec);
+}
+
+
+std::string PhantomCache::path(uint64_t key) const {
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.phantom", static_cast<unsigned long long>(key));
+	return (std::filesystem::path(dir) / name).string();
+}
+
+
+bool PhantomCache::load(uint64_t key, Phantom &phantom, std::vector<std::string> &materials) const {
+	std::string fn = path(key);
+	if (!io::isfile(fn)) return false;
+	try {
+		io::mmap_file file(fn);
+		Header h;
+		if (file.size() < sizeof(Header)) return false;
+		std::memcpy(&h, file.data(), sizeof(Header));
+		if (std::memcmp(h.magic, magic, sizeof(magic)) != 0 || h.key != key) return false;
+		if (h.nvox != uint64_t(h.num_voxels[0]) * h.num_voxels[1] * h.num_voxels[2]) return false;
+		//density, medium and names in order inside the file, checked so nothing below can overflow or read past the mapping
+		const uint64_t size = file.size();
+		if (h.nvox > size / (2 * sizeof(float))) return false;
+		const uint64_t bytes = h.nvox * sizeof(float);
+		if (h.density_offset % alignment != 0 || h.medium_offset % alignment != 0) return false;
+		if (h.density_offset < sizeof(Header) || h.density_offset > size || bytes > size - h.density_offset) return false;
+		if (h.medium_offset < h.density_offset + bytes || h.medium_offset > size || bytes > size - h.medium_offset) return false;
+		if (h.materials_offset < h.medium_offset + bytes || h.materials_offset > size || h.materials_bytes != size - h.materials_offset) return false;
+
+		phantom.numVoxels.x = h.num_voxels[0];
+		phantom.numVoxels.y = h.num_voxels[1];
+		phantom.numVoxels.z = h.num_voxels[2];
+		phantom.voxelSizes.x = h.voxel_sizes[0];
+		phantom.voxelSizes.y = h.voxel_sizes[1];
+		phantom.voxelSizes.z = h.voxel_sizes[2];
+		phantom.phantomCorner.x = h.phantom_corner[0];
+		phantom.phantomCorner.y = h.phantom_corner[1];
+		phantom.phantomCorner.z = h.phantom_corner[2];
+		//gpumcd wants its own vectors, so one copy out of the mapping
+		const float* density = reinterpret_cast<const float*>(file.data() + h.density_offset);
+		const float* medium = reinterpret_cast<const float*>(file.data() + h.medium_offset);
+		phantom.massDensityArray.assign(density, density + h.nvox);
+		phantom.mediumIndexArray.assign(medium, medium + h.nvox);
+
+		materials.clear();
+		std::string names(file.data() + h.materials_offset, h.materials_bytes);
+		size_t start = 0;
+		for (size_t end = names.find('\n'); end != std::string::npos; start = end + 1, end = names.find('\n', start)){
+			materials.push_back(names.substr(start, end - start));
+		}
+	}
+	catch (const std::pair<int, std::string> &) {
+		return false; //unreadable, recompute
+	}
+
+	std::error_code ec;
+	std::filesystem::last_write_time(fn, std::filesystem::file_time_type::clock::now(), ec); //most recently used
+	return true;
+}
+
+
+bool PhantomCache::store(uint64_t key, const Phantom &phantom, const std::vector<std::string> &materials) const {
+	Header h = {};
+	std::memcpy(h.magic, magic, sizeof(magic));
+	h.key = key;
+	h.num_voxels[0] = phantom.numVoxels.x;
+	h.num_voxels[1] = phantom.numVoxels.y;
+	h.num_voxels[2] = phantom.numVoxels.z;
+	h.voxel_sizes[0] = phantom.voxelSizes.x;
+	h.voxel_sizes[1] = phantom.voxelSizes.y;
+	h.voxel_sizes[2] = phantom.voxelSizes.z;
+	h.phantom_corner[0] = phantom.phantomCorner.x;
+	h.phantom_corner[1] = phantom.phantomCorner.y;
+	h.phantom_corner[2] = phantom.phantomCorner.z;
+	h.nvox = phantom.massDensityArray.size();
+	if (phantom.mediumIndexArray.size() != h.nvox) return false;
+	std::string names;
+	for (const auto &m : materials) names += m + "\n";
+	h.density_offset = aligned(sizeof(Header));
+	h.medium_offset = aligned(h.density_offset + h.nvox * sizeof(float));
+	h.materials_offset = aligned(h.medium_offset + h.nvox * sizeof(float));
+	h.materials_bytes = names.size();
+
+	std::string fn = path(key);
+#ifdef _WIN32
+	long long pid = _getpid();
+#else
+	long long pid = getpid();
+#endif
+	std::string tmp = fn + ".tmp" + std::to_string(pid) + "_" + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id()));
+	std::error_code stale;
+	std::filesystem::remove(tmp, stale); //only a dead process that had our pid can have left this name
+	FILE* ffile = fopen(tmp.c_str(), "wbx"); //fails rather than share a file with another writer
+	if (ffile == nullptr) return false;
+	const char zeros[alignment] = {};
+	auto pad_to = [&](uint64_t offset){
+		int64_t at = io::tell(ffile); //64 bit, phantoms can be over 2 GB
+		if (at < 0 || uint64_t(at) > offset) return false;
+		size_t n = size_t(offset - at);
+		return fwrite(zeros, 1, n, ffile) == n;
+	};
+	bool ok = fwrite(&h, sizeof(Header), 1, ffile) == 1;
+	ok = ok && pad_to(h.density_offset);
+	ok = ok && fwrite(phantom.massDensityArray.data(), sizeof(float), h.nvox, ffile) == h.nvox;
+	ok = ok && pad_to(h.medium_offset);
+	ok = ok && fwrite(phantom.mediumIndexArray.data(), sizeof(float), h.nvox, ffile) == h.nvox;
+	ok = ok && pad_to(h.materials_offset);
+	ok = ok && fwrite(names.data(), 1, names.size(), ffile) == names.size();
+	ok = (fclose(ffile) == 0) && ok;
+
+	std::error_code ec;
+	if (ok) std::filesystem::rename(tmp, fn, ec);
+	if (!ok || ec){
+		std::filesystem::remove(tmp, ec);
+		return false;
+	}
+	trim();
+	return true;
+}
+
+
+void PhantomCache::trim() const {
+	//drop least recently used files until the directory fits in max_bytes
+	std::error_code ec;
+	std::vector<std::pair<std::filesystem::file_time_type, std::filesystem::path>> files;
+	size_t total = 0;
+	for (const auto &entry : std::filesystem::directory_iterator(dir, ec)){
+		if (entry.path().extension() != ".phantom") continue;
+		size_t size = entry.file_size(ec);
+		if (ec) continue;
+		total += size;
+		files.push_back({ entry.last_write_time(ec), entry.path() });
+	}
+	std::sort(files.begin(), files.end());
+	for (const auto &f : files){
+		if (total <= max_bytes) break;
+		size_t size = std::filesystem::file_size(f.second, ec);
+		if (std::filesystem::remove(f.second, ec)) total -= size;
+	}
+}
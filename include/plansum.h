@@ -0,0 +1,113 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <string>
+#include <cmath>
+#include "image.h"
+#include "tiledimage.h"
+#include "threads.h" //ThreadPool, parallel_for
+#include "rt.h" //BeamMetaData
+
+/*
+ * Sum of dose files (beams, arcs, fraction groups) on one grid, each scaled, without holding more than one of them.
+ * Files are read in z-slabs through TiledImage, a few slabs ahead on background threads while the current one is added,
+ * so peak memory is the sum plus about io_bytes. Files are added in the order given, so the result is the same
+ * as loading each in full and adding them one after the other.
+ */
+
+class PlanSum {
+public:
+	PlanSum(size_t = size_t(64) << 20, int = 2, unsigned int = 0); //io_bytes for slabs in flight, nr of slabs read ahead, nthreads for adding
+
+	void add(const std::string &, float); //dose file, scale
+	void add(const std::string &, const BeamMetaData &); //dose file of a beam, scaled by beam_scale()
+	size_t size() const { return beams.size(); };
+
+	static float beam_scale(const BeamMetaData &); //weight * mu per fraction, times nr of fractions unless dose_per_fraction (as in Parser::setCPIs)
+	Image sum() const; //reads every file once
+
+private:
+	size_t io_bytes;
+	int ahead;
+	unsigned int nthreads;
+	std::vector<std::pair<std::string, float>> beams;
+};
+
+
+PlanSum::PlanSum(size_t _io_bytes, int _ahead, unsigned int _nthreads) : io_bytes(_io_bytes), ahead(std::max(_ahead, 1)), nthreads(_nthreads){
+}
+
+
+void PlanSum::add(const std::string &fname, float scale){
+	beams.push_back({ fname, scale });
+}
+
+
+void PlanSum::add(const std::string &fname, const BeamMetaData &beam){
+	add(fname, beam_scale(beam));
+}
+
+
+float PlanSum::beam_scale(const BeamMetaData &beam){
+	return beam.weight * beam.mu_per_fraction * (beam.dose_per_fraction ? 1 : beam.nr_fractions);
+}
+
+
+Image PlanSum::sum() const {
+	if (beams.empty()) throw std::pair<int, std::string>(80, "Plan sum of no dose files.");
+
+	//open all first: only headers are read, so a file on another grid fails before any voxel is
+	const ImageInfo first = Image::probe(beams[0].first);
+	if (first.ndim() != 3) throw std::pair<int, std::string>(80, "Plan sum needs 3D dose files, '" + beams[0].first + "' is not.");
+	const size_t slice = size_t(first.dim_size[0]) * first.dim_size[1];
+	const int depth = int(std::max<size_t>(1, io_bytes / (ahead + 1) / (slice * sizeof(float))));
+	std::vector<std::unique_ptr<TiledImage>> tiles;
+	for (const auto &beam : beams){
+		tiles.push_back(std::make_unique<TiledImage>(beam.first, 1, depth)); //budget of a byte: keeps only the slab last read
+		const ImageInfo &info = tiles.back()->info();
+		bool same = info.dim_size == first.dim_size;
+		for (int a = 0; same && a < 3; a++){
+			same = std::fabs(info.voxel_sizes[a] - first.voxel_sizes[a]) < 1e-4f && std::fabs(info.min_ext[a] - first.min_ext[a]) < 1e-4f;
+		}
+		if (!same) throw std::pair<int, std::string>(80, "Dose file '" + beam.first + "' is not on the grid of '" + beams[0].first + "'.");
+	}
+
+	Image ret = tiles[0]->geometry().copy_with_new_voxels(std::vector<float>(first.nvox(), 0.f));
+	std::vector<std::pair<size_t, int>> jobs; //beam, slab
+	for (size_t b = 0; b < beams.size(); b++){
+		for (int s = 0; s < tiles[b]->nslabs(); s++) jobs.push_back({ b, s });
+	}
+
+	//declared after tiles, so reads still queued when an error leaves this function finish before the files close
+	threads::ThreadPool readers(ahead);
+	std::deque<std::future<std::shared_ptr<const Image>>> pending;
+	size_t next = 0;
+	auto read_ahead = [&]{
+		while (next < jobs.size() && pending.size() < size_t(ahead)){
+			TiledImage* tile = tiles[jobs[next].first].get();
+			int s = jobs[next].second;
+			pending.push_back(readers.submit([tile, s]{ return tile->slab(s); }));
+			next++;
+		}
+	};
+
+	for (size_t j = 0; j < jobs.size(); j++){
+		read_ahead();
+		std::shared_ptr<const Image> slab = pending.front().get();
+		pending.pop_front();
+		read_ahead();
+
+		const size_t b = jobs[j].first;
+		const float scale = beams[b].second;
+		const float* dose = slab->imdata.data();
+		float* out = ret.imdata.data() + size_t(tiles[b]->slab_first_z(jobs[j].second)) * slice;
+		threads::parallel_for(slab->dim_size[2], [&](size_t z){
+			for (size_t i = z * slice; i < (z + 1) * slice; i++) out[i] += dose[i] * scale;
+		}, nthreads);
+
+		if (j + 1 == jobs.size() || jobs[j + 1].first != b) tiles[b].reset(); //done with this file
+	}
+	return ret;
+}
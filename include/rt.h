@@ -4,6 +4,14 @@
 //#include <string>
 //using std::string;
 #include <assert.h>
+#include <limits>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <future>
+#include <exception> //std::exception
+#include <filesystem>
+#include <algorithm> //std::sort
 
 #include "CalculationInformation.h"
 
@@ -14,8 +22,10 @@ using std::string;
 using namespace parse;
 using namespace vect;
 #include "settings.h"
+#include "threads.h" //ThreadPool
 
 class RTBeam;
+class DumpCache;
 class Parser;
 class dicomParser;
 class pinnacleParser;
@@ -69,10 +79,10 @@ struct BeamMetaData {
 	//ct metadata
 	float hu_slope;
 	float hu_intercept;
-	float outsidepatientairthreshold;
-	int outsidepatientisctnumber;
+	float outsidepatientairthreshold = 0.6f; //mass density, pinnacle default
+	int outsidepatientisctnumber = 0; //raw ct value given to voxels outside the patient
 	string patient_position;
-	float couchremovalycoordinate;
+	float couchremovalycoordinate = std::numeric_limits<float>::quiet_NaN(); //plan y, NaN when there is no couch to remove
 	float couch_height;
 	
 	//params
@@ -101,11 +111,60 @@ public:
 
 	RTBeam(DosiaSettings &);
 
+	//all beams of a plan: rt_files is a beam directory (with dbtype.dump), or a directory of them.
+	//beams load concurrently on nthreads and come back in directory name order. with errors, beams fail on their own:
+	//errors gets a code and message per beam (0 when it loaded) and a failed beam is left empty. without, the first failed beam throws.
+	//std::exceptions from parsing a beam (a malformed number in a dump) are reported for that beam as code 29, as malformed dicom values are.
+	//trial, plan and dose dumps with the same contents in several beam directories are tokenized once for all of them.
+	static vector<RTBeam> load_plan(const DosiaSettings &, vector<std::pair<int, string>>* = nullptr, unsigned int = 0);
+	static vector<string> plan_beams(const string &); //beam directories of a plan directory
+
 private:
 	DosiaSettings sett;
+
+	RTBeam(DosiaSettings &, DumpCache*); //plan level dumps through the cache, when there is one
+};
+
+
+//tokenized dumps by their contents, shared by the beams of a plan. a dump is tokenized by the first beam asking for it,
+//the others wait for that one. see RTBeam::load_plan().
+class DumpCache {
+public:
+	using Dump = vector<std::pair<string, string>>;
+	std::shared_ptr<const Dump> get(const string &); //throws 73 as load_dump() when the file cannot be read
+
+private:
+	std::mutex mutex;
+	std::map<uint64_t, std::shared_future<std::shared_ptr<const Dump>>> dumps;
 };
 
 
+std::shared_ptr<const DumpCache::Dump> DumpCache::get(const string &fn){
+	DumpFile file(fn);
+	const uint64_t key = file.hash();
+	std::promise<std::shared_ptr<const Dump>> mine;
+	std::shared_future<std::shared_ptr<const Dump>> ret;
+	bool first = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = dumps.find(key);
+		first = (it == dumps.end());
+		if (first) dumps[key] = ret = mine.get_future().share();
+		else ret = it->second;
+	}
+	if (!first) return ret.get(); //waits only while another beam is tokenizing it
+	try {
+		auto dump = std::make_shared<Dump>();
+		file.for_each([&dump](std::string_view key, std::string_view value){ dump->emplace_back(key, value); });
+		mine.set_value(std::move(dump));
+	}
+	catch (...) {
+		mine.set_exception(std::current_exception());
+	}
+	return ret.get();
+}
+
+
 class Parser{
 protected:
 	//members
@@ -144,6 +203,9 @@ private:
 	void parseBeam(const string &);
 	//void parseScan(const string &){};//not needed
 	void parseDose(const string &);//prescription dose
+	void parseTrial(const DumpCache::Dump &); //the same, on a dump tokenized before
+	void parsePlan(const DumpCache::Dump &);
+	void parseDose(const DumpCache::Dump &);
 	//void setCPIs();
 
 	//ctors
@@ -159,7 +221,7 @@ private:
 	dicomParser(BeamMetaData, bool = false);
 	//void parseTrial(const string &){};//doesnt exist
 	//void parsePlan(const string &); //TODO NOT IMPLEMENTED, SUSPICION: NO RELEVANT INFO HERE
-	void parseBeam(const string &); //TODO
+	void parseBeam(const string &); //weight, machine, control points, isoc
 	void parseScan(const string &); //intercept, slope
 	//void parseDose(const string &){};//prescription dose
 	void setCPIs();
@@ -191,37 +253,48 @@ dicomParser::dicomParser(BeamMetaData _metaData, bool _debug) : Parser(_metaData
 
 
 void pinnacleParser::parseTrial(const string &inFile) {
-	auto dump = load_dump(inFile);
+	parseTrial(load_dump(inFile));
+}
+
+void pinnacleParser::parseTrial(const DumpCache::Dump &dump) {
 	assert(!dump.empty());
 
 	for (auto &line : dump) {
-		/*if (startswith(line.first, "requestedmonitorunitsperfraction[")) {	//better take this from dose.dump
-			metaData.mu_per_fraction = stof(line.second);
-			continue;
-		}*/
-		if (startswith(line.first, "numberoffractions[")) {
-			metaData.nr_fractions = stoi(line.second);
+		const string &key = line.first;
+		switch (key_hash(key_prefix(key, { "negativemupenalty", "outsidepatientairthreshold", "outsidepatientisctnumber", "couchremovalycoordinate" }))) {
+		/*case key_hash("requestedmonitorunitsperfraction"):	//better take this from dose.dump
+			if (startswith(key, "requestedmonitorunitsperfraction[")) metaData.mu_per_fraction = stof(line.second);
+			continue;*/
+		case key_hash("numberoffractions"):
+			if (startswith(key, "numberoffractions[")) {
+				metaData.nr_fractions = stoi(line.second);
+			}
 			continue;
-		}
-		if (startswith(line.first, "negativemupenalty")) {
-			metaData.hu_intercept = -stoi(line.second); //NEGATIVE!!!
-			metaData.hu_slope = 1.f; //There is no slope in pinnacle.
+		case key_hash("negativemupenalty"):
+			if (startswith(key, "negativemupenalty")) {
+				metaData.hu_intercept = -stoi(line.second); //NEGATIVE!!!
+				metaData.hu_slope = 1.f; //There is no slope in pinnacle.
+			}
 			continue;
-		}
-		if (startswith(line.first, "outsidepatientairthreshold")) {
-			metaData.outsidepatientairthreshold = stof(line.second);
+		case key_hash("outsidepatientairthreshold"):
+			if (startswith(key, "outsidepatientairthreshold")) {
+				metaData.outsidepatientairthreshold = stof(line.second);
+			}
 			continue;
-		}
-		if (startswith(line.first, "outsidepatientisctnumber")) {
-			metaData.outsidepatientisctnumber = stoi(line.second); // this is pre-offset
+		case key_hash("outsidepatientisctnumber"):
+			if (startswith(key, "outsidepatientisctnumber")) {
+				metaData.outsidepatientisctnumber = stoi(line.second); // this is pre-offset
+			}
 			continue;
-		}
-		if (startswith(line.first, "patient_position")) {
-			metaData.patient_position = line.second;
+		case key_hash("patient"):
+			if (startswith(key, "patient_position")) {
+				metaData.patient_position = line.second;
+			}
 			continue;
-		}
-		if (startswith(line.first, "couchremovalycoordinate")) {
-			metaData.couchremovalycoordinate = stof(line.second);
+		case key_hash("couchremovalycoordinate"):
+			if (startswith(key, "couchremovalycoordinate")) {
+				metaData.couchremovalycoordinate = stof(line.second);
+			}
 			continue;
 		}
 	}
@@ -231,16 +304,24 @@ void pinnacleParser::parseTrial(const string &inFile) {
 }
 
 void pinnacleParser::parseDose(const string &inFile) {
-	auto dump = load_dump(inFile);
+	parseDose(load_dump(inFile));
+}
+
+void pinnacleParser::parseDose(const DumpCache::Dump &dump) {
 	assert(!dump.empty());
 
 	for (auto &line : dump) {
-		if (startswith(line.first, "prescriptiondose")) {
-			metaData.prescriptiondose = stof(line.second);
+		const string &key = line.first;
+		switch (key_hash(key_prefix(key, { "prescriptiondose", "requestedmonitorunitsperfraction" }))) {
+		case key_hash("prescriptiondose"):
+			if (startswith(key, "prescriptiondose")) {
+				metaData.prescriptiondose = stof(line.second);
+			}
 			continue;
-		}
-		if (startswith(line.first, "requestedmonitorunitsperfraction")) {
-			metaData.mu_per_fraction = stof(line.second);
+		case key_hash("requestedmonitorunitsperfraction"):
+			if (startswith(key, "requestedmonitorunitsperfraction")) {
+				metaData.mu_per_fraction = stof(line.second);
+			}
 			continue;
 		}
 	}
@@ -251,44 +332,53 @@ void dicomParser::parseScan(const string &inFile) {
 	assert(!dump.empty());
 
 	for (auto &line : dump) {
-		if (startswith(line.first, "RescaleIntercept")) {
-			metaData.hu_intercept = stof(line.second);
+		const string &key = line.first;
+		switch (key_hash(key_prefix(key, { "RescaleIntercept", "RescaleSlope", "ImagePositionPatient" }))) {
+		case key_hash("RescaleIntercept"):
+			if (startswith(key, "RescaleIntercept")) {
+				metaData.hu_intercept = stof(line.second);
+			}
 			continue;
-		}
-		if (startswith(line.first, "RescaleSlope")) {
-			metaData.hu_slope = stof(line.second);
+		case key_hash("RescaleSlope"):
+			if (startswith(key, "RescaleSlope")) {
+				metaData.hu_slope = stof(line.second);
+			}
 			continue;
-		}
-		if (startswith(line.first, "ImagePositionPatient")) {
+		case key_hash("ImagePositionPatient"):
 			/*
 			auto pos = split_vec<float>(line.second, "\\");
 			fprintf(stderr, "RTPLan: dicom ImagePositionPatient : %.2f,%.2f,%.2f\n", x,y,z);
 			*/
 			continue;
 		}
-
-		
 	}
 	if (debug) fprintf(stderr, "RTPLan: dicom intercept, slope: %.2f,%.2f\n", metaData.hu_intercept, metaData.hu_slope);
 }
 
 
 void pinnacleParser::parsePlan(const string &inFile) {
-	auto dump = load_dump(inFile);
+	parsePlan(load_dump(inFile));
+}
+
+void pinnacleParser::parsePlan(const DumpCache::Dump &dump) {
 	assert(!dump.empty());
 
 	assert(!metaData.isocentername.empty());
 
+	//the isoc name may hold any separator, so no key_hash here. keys are compared case insensitive to the lowered name, made once.
+	const string isoc_x = lower(metaData.isocentername) + "_x";
+	const string isoc_y = lower(metaData.isocentername) + "_y";
+	const string isoc_z = lower(metaData.isocentername) + "_z";
 	for (auto &line : dump) {
-		if (startswith(lower(line.first), lower(metaData.isocentername) + "_x")) { //normalize case for isoc name
+		if (istartswith(line.first, isoc_x)) { //normalize case for isoc name
 			metaData.isoc.x = stof(line.second);
 			continue;
 		}
-		if (startswith(lower(line.first), lower(metaData.isocentername) + "_y")) { //minus!
+		if (istartswith(line.first, isoc_y)) { //minus!
 			metaData.isoc.y = -stof(line.second);
 			continue;
 		}
-		if (startswith(lower(line.first), lower(metaData.isocentername) + "_z")) { //minus!
+		if (istartswith(line.first, isoc_z)) { //minus!
 			metaData.isoc.z = -stof(line.second);
 			continue;
 		}
@@ -297,210 +387,179 @@ void pinnacleParser::parsePlan(const string &inFile) {
 }
 
 void dicomParser::parseBeam(const string &inFile) {
-	auto dump = load_dump(inFile);
-	assert(!dump.empty());
+	DumpTree dump(inFile);
+	const DumpTree::Node &beam = dump.root;
+	assert(!beam.empty());
 
+	//here we look for the beam weight: the meterset of the referenced beam with our beam number
 	vector<int> ReferencedBeamNumber;
 	vector<float> BeamDose;
 	vector<float> BeamMeterset;
+	for (const auto &fraction_group : beam.sequence("FractionGroupSequence")){
+		if (auto v = fraction_group.get("NumberOfFractionsPlanned")) metaData.nr_fractions = stoi(*v);
+		for (const auto &referenced : fraction_group.sequence("ReferencedBeamSequence")){
+			auto number = referenced.get("ReferencedBeamNumber");
+			auto meterset = referenced.get("BeamMeterset");
+			if (number == nullptr || meterset == nullptr) continue;
+			auto dose = referenced.get("BeamDose");
+			ReferencedBeamNumber.push_back(stoi(*number));
+			BeamMeterset.push_back(stof(*meterset));
+			BeamDose.push_back(dose ? stof(*dose) : 0.f);
+		}
+	}
+	if (auto v = beam.get("BeamNumber")) {
+		assert(len(ReferencedBeamNumber) > 0);
+		//metaData.weight = BeamDose[index(ReferencedBeamNumber, stoi(*v))]; // TODO: not sure which
+		metaData.weight = BeamMeterset[index(ReferencedBeamNumber, stoi(*v))];
+	}
+	metaData.mu_per_fraction = 1.f; //the meterset is the mu per fraction already, there is no dose.dump to take it from
 
-	vector<string> BeamLimitingDeviceSequence(3); //should usually have 2 or 3.
+	if (auto v = beam.get("TreatmentMachineName")) {
+		if (startswith(*v, "MLC160")){
+			metaData.accelerator = Accelerator(AcceleratorType::Agility);
+		}
+		else if (startswith(*v, "M160")){
+			metaData.accelerator = Accelerator(AcceleratorType::Agility);
+		}
+		else if (startswith(*v, "MLC80")){
+			metaData.accelerator = Accelerator(AcceleratorType::MLCi80);
+		}
+		else if (startswith(*v, "M80")){
+			metaData.accelerator = Accelerator(AcceleratorType::MLCi80);
+		}
+		else {
+			metaData.accelerator = Accelerator(AcceleratorType::UNKNOWN);
+		}
+	}
 
-	for (auto &line : dump) {
-		if (startswith(line.first, "FractionGroupSequence")) { //here we look for the beam weight, which is not yet known here
-			vector<string> line_breakdown = split(line.first, ".");
-			if (line_breakdown.size() <= 1) continue; //one or less: nothing to split. ignore
-			
-			if (line_breakdown[1] == "NumberOfFractionsPlanned"){
-				metaData.nr_fractions = stoi(line.second);
-			}
+	const auto &devices = beam.sequence("BeamLimitingDeviceSequence");
+	if (devices.size() > 3) throw std::pair<int, string>(24, "Unexpected number of BeamLimitingDevices.");
+	vector<string> BeamLimitingDeviceSequence(3); //should usually have 2 or 3.
+	for (size_t blds = 0; blds < devices.size(); blds++){
+		if (auto v = devices[blds].get("RTBeamLimitingDeviceType")) BeamLimitingDeviceSequence[blds] = *v;
+		auto pairs = devices[blds].get("NumberOfLeafJawPairs");
+		if (pairs && BeamLimitingDeviceSequence[blds] == "MLCX"){
+			if (metaData.accelerator.leafs_per_bank != stoi(*pairs)) throw std::pair<int, string>(25, "Number of Leafs does not correspond to specified Accelerator.");
+		}
+	}
 
-			int blds = get_index(line_breakdown[1]); //centerpiece has beam index
-			if (blds < 0) continue; // can be no number, then skip
+	if (auto v = beam.get("NumberOfControlPoints")) {
+		controlPoints.resize(stoi(*v));
+		for (auto &cp : controlPoints){
+			cp.collimator.mlc.leftLeaves.resize(metaData.accelerator.leafs_per_bank); // leaf_per_bank is set above
+			cp.collimator.mlc.rightLeaves.resize(metaData.accelerator.leafs_per_bank);
+		}
+	}
 
-			if (line_breakdown[2] == "BeamDose"){
-				BeamDose.push_back(stof(line.second));
-			}
-			if (line_breakdown[2] == "BeamMeterset"){
-				BeamMeterset.push_back(stof(line.second));
-			}
-			continue;
+	if (auto v = beam.get("BeamType")) {
+		if (startswith(*v, "DYNAMIC")){
+			metaData.beamtype = BeamType::VMAT;
 		}
-		if (line.first == "TreatmentMachineName") {
-			if (startswith(line.second, "MLC160")){
-				metaData.accelerator = Accelerator(AcceleratorType::Agility);
-				continue;
-			}
-			else if (startswith(line.second, "M160")){
-				metaData.accelerator = Accelerator(AcceleratorType::Agility);
-				continue;
-			}
-			else if (startswith(line.second, "MLC80")){
-				metaData.accelerator = Accelerator(AcceleratorType::MLCi80);
-				continue;
-			}
-			else if (startswith(line.second, "M80")){
-				metaData.accelerator = Accelerator(AcceleratorType::MLCi80);
-				continue;
-			}
-			else {
-				metaData.accelerator = Accelerator(AcceleratorType::UNKNOWN);
-				continue;
-			}
+		//following copied from pinnacle::parseBeam
+		else if (startswith(*v, "Dynamic Arc")){
+			metaData.beamtype = BeamType::VMAT;
 		}
-		if (startswith(line.first, "BeamLimitingDeviceSequence")) {
-			vector<string> line_breakdown = split(line.first, ".");
-			if (line_breakdown.size() <= 1) continue; //one or less: nothing to split. ignore
-
-			int blds = get_index(line_breakdown[0]);
-			if (blds < 0) continue; // can be no number, then skip
-			if (blds > 2) throw std::pair<int, string>(24, "Unexpected number of BeamLimitingDevices.");
-
-			if (line_breakdown[1] == "RTBeamLimitingDeviceType"){
-				BeamLimitingDeviceSequence[blds] = line.second;
-			}
-			if (line_breakdown[1] == "NumberOfLeafJawPairs"){
-				if (BeamLimitingDeviceSequence[blds] == "MLCX"){
-					if (metaData.accelerator.leafs_per_bank != stoi(line.second)) throw std::pair<int, string>(25, "Number of Leafs does not correspond to specified Accelerator.");
-				}
-			}
+		else if (startswith(*v, "Step & Shoot MLC")){
+			metaData.beamtype = BeamType::IMRT;
 		}
-		if (line.first == "BeamNumber") {
-			assert(len(BeamDose) == len(BeamMeterset) == len(ReferencedBeamNumber));
-			assert(len(ReferencedBeamNumber) > 0);
-			//metaData.weight = BeamDose[stoi(line.first)]; // TODO: not sure which
-			metaData.weight = BeamMeterset[index(ReferencedBeamNumber, stoi(line.first))];
-			continue;
+		else if (startswith(*v, "Static")){
+			metaData.beamtype = BeamType::IMRT;
 		}
-		if (line.first == "NumberOfControlPoints") {
-			controlPoints.resize(stoi(line.second));
-			for (int i = 0; i < stoi(line.second); i++){
-				controlPoints[i].collimator.mlc.leftLeaves.resize(metaData.accelerator.leafs_per_bank); // leaf_per_bank should be set before
-				controlPoints[i].collimator.mlc.rightLeaves.resize(metaData.accelerator.leafs_per_bank);
-			}
-			continue;
+		else {
+			metaData.beamtype = BeamType::UNKNOWN;
 		}
-		if (startswith(line.first, "BeamType")) {
-			if (startswith(line.second, "DYNAMIC")){
-				metaData.beamtype = BeamType::VMAT;
-			}
-			//following copied from pinnacle::parseBeam
-			else if (startswith(line.second, "Dynamic Arc")){
-				metaData.beamtype = BeamType::VMAT;
+	}
+
+	for (const auto &setup : beam.sequence("PatientSetupSequence")){
+		if (auto v = setup.get("PatientPosition")) metaData.patient_position = *v;
+	}
+	for (const auto &mode : beam.sequence("PrimaryFluenceModeSequence")){
+		auto id = mode.get("FluenceModeID");
+		if (id && startswith(*id, "FFF")) metaData.accelerator.filter = Filter::NoFF;
+	}
+
+	//dicom positions are mm, ours cm. cumulative weights run to FinalCumulativeMetersetWeight, ours to 1.
+	const float mm = 0.1f;
+	auto final_weight = beam.get("FinalCumulativeMetersetWeight");
+	const float weight_scale = (final_weight && stof(*final_weight) > 0) ? 1.f / stof(*final_weight) : 1.f;
+
+	//control points only touch their own entry, except for the energy
+	const auto &cps = beam.sequence("ControlPointSequence");
+	for (size_t cpi = 0; cpi < cps.size(); cpi++){
+		const DumpTree::Node &item = cps[cpi];
+		if (item.empty()) continue; //not in the dump
+		if (int(cpi) > num_cps() - 1) throw std::pair<int, string>(26, "CPI out of range.");
+		ControlPoint &cp = controlPoints[cpi];
+
+		if (auto v = item.get("ControlPointIndex")) assert(int(cpi) == stoi(*v));
+		if (auto v = item.get("NominalBeamEnergy")) {
+			if (startswith(*v, "6")){
+				metaData.accelerator.energy = Energy::MV6;
 			}
-			else if (startswith(line.second, "Step & Shoot MLC")){
-				metaData.beamtype = BeamType::IMRT;
+			else if (startswith(*v, "10")){
+				metaData.accelerator.energy = Energy::MV10;
 			}
-			else if (startswith(line.second, "Static")){
-				metaData.beamtype = BeamType::IMRT;
+			else if (startswith(*v, "7")){ //cant happen I guess
+				metaData.accelerator.energy = Energy::MV7;
 			}
 			else {
-				metaData.beamtype = BeamType::UNKNOWN;
-			}
-			continue;
-		}
-		if (startswith(line.first, "PatientSetupSequence")) {
-			vector<string> line_breakdown = split(line.first, ".");
-			if (line_breakdown[1] == "PatientPosition"){
-				metaData.patient_position = line.second;
+				metaData.accelerator.energy = Energy::UNKNOWN;
 			}
-			continue;
 		}
-		if (startswith(line.first, "ControlPointSequence")) {
-			vector<string> line_breakdown = split(line.first, ".");
-			if (line_breakdown.size() <= 1) continue; //one or less: nothing to split. ignore
-
-			//get CPI
-			int cpi = get_index(line_breakdown[0]);
-			if (cpi < 0) continue; // can be no number, then skip
-			if (cpi > num_cps() - 1) throw std::pair<int, string>(26, "CPI out of range.");
-
-			if (line_breakdown[1] == "ControlPointIndex") {
-				assert(cpi == stoi(line.second));
-				continue;
-			}
-			if (line_breakdown[1] == "NominalBeamEnergy") {
-				if (startswith(line.second, "6")){
-					metaData.accelerator.energy = Energy::MV6;
-				}
-				else if (startswith(line.second, "10")){
-					metaData.accelerator.energy = Energy::MV10;
-				}
-				else if (startswith(line.second, "7")){ //cant happen I guess
-					metaData.accelerator.energy = Energy::MV7;
-				}
-				else {
-					metaData.accelerator.energy = Energy::UNKNOWN;
-				}
-				continue;
-			}
-			if (line_breakdown[1] == "NumberOfCompensators") { //TODO
-				/*if (endswith(line.second, "FFF")){
-				metaData.accelerator.filter = Filter::NoFF;
-				//TODO: imrtfilter="Compensator" == FFF?
-				}*/
-				continue;
-			}
-			if (line_breakdown[1] == "GantryAngle") {
-				controlPoints[cpi].beamInfo.gantryAngle = { stof(line.second), stof(line.second) };
-				continue;
-			}
-			if (line_breakdown[1] == "PatientSupportAngle") {
-				controlPoints[cpi].beamInfo.couchAngle = { stof(line.second), stof(line.second) };
-				continue;
-			}
-			if (line_breakdown[1] == "BeamLimitingDeviceAngle") {
-				controlPoints[cpi].beamInfo.collimatorAngle = { stof(line.second), stof(line.second) };
-				continue;
-			}
-			if (line_breakdown[1] == "IsocenterPosition") {
-				auto pos = types::split<float>(line.second, "\\");
-				controlPoints[cpi].beamInfo.isoCenter.x = pos[0];
-				controlPoints[cpi].beamInfo.isoCenter.y = pos[1];
-				controlPoints[cpi].beamInfo.isoCenter.z = pos[2];
-				continue;
-			}
-			if (line_breakdown[1] == "CumulativeMetersetWeight") {
-				if (cpi == 0) {
-					controlPoints[cpi].beamInfo.relativeWeight = stof(line.second);
-				}
-				else {
-					controlPoints[cpi].beamInfo.relativeWeight = stof(line.second) - controlPoints[cpi - 1].beamInfo.relativeWeight;
-				}
-				continue;
-			}
-			if (startswith(line_breakdown[1], "BeamLimitingDevicePositionSequence")) {
-				int bldi = get_index(line_breakdown[1]);
-				if (bldi < 0) continue; // can be no number, then skip
-
-				if (line_breakdown[2] == "LeafJawPositions") {
-					auto pos = types::split<float>(line.second,"\\");
-					if (BeamLimitingDeviceSequence[bldi] == "ASMX"){
-						controlPoints[get_index(line.first)].collimator.parallelJaw.j1 = { pos[0], pos[0] }; //J1 always most negative coord according to doc.
-						controlPoints[get_index(line.first)].beamInfo.fieldMin.first = pos[0] - metaData.fieldMargin;
-
-						controlPoints[get_index(line.first)].collimator.parallelJaw.j2 = { pos[1], pos[1] };
-						controlPoints[get_index(line.first)].beamInfo.fieldMax.first = pos[1] + metaData.fieldMargin;
-					}
-					if (BeamLimitingDeviceSequence[bldi] == "ASMY"){
-						controlPoints[get_index(line.first)].collimator.perpendicularJaw.j1 = { pos[0], pos[0] };
-						controlPoints[get_index(line.first)].beamInfo.fieldMin.second = pos[0] - metaData.fieldMargin;
-
-						controlPoints[get_index(line.first)].collimator.perpendicularJaw.j2 = { pos[1], pos[1] };
-						controlPoints[get_index(line.first)].beamInfo.fieldMax.second = pos[1] + metaData.fieldMargin;
-					}
-					if (BeamLimitingDeviceSequence[bldi] == "MLCX"){
-						//pos heeft right bank eerst
-						for (int p = 0; p < metaData.accelerator.leafs_per_bank; p++){
-							controlPoints[cpi].collimator.mlc.rightLeaves[p] = { pos[p], pos[p] };
-							controlPoints[cpi].collimator.mlc.leftLeaves[p] = { pos[p + metaData.accelerator.leafs_per_bank], pos[p + metaData.accelerator.leafs_per_bank] };
-						}
-						//NOOT: for square fields dicom does not necesarily give MLCX positions. Only jaw positions may be encountered!!
-					}
+		//NumberOfCompensators: TODO
+		/*if (endswith(line.second, "FFF")){
+		metaData.accelerator.filter = Filter::NoFF;
+		//TODO: imrtfilter="Compensator" == FFF?
+		}*/
+		if (auto v = item.get("GantryAngle")) cp.beamInfo.gantryAngle = { stof(*v), stof(*v) };
+		if (auto v = item.get("PatientSupportAngle")) cp.beamInfo.couchAngle = { stof(*v), stof(*v) };
+		if (auto v = item.get("BeamLimitingDeviceAngle")) cp.beamInfo.collimatorAngle = { stof(*v), stof(*v) };
+		if (auto v = item.get("IsocenterPosition")) {
+			//patient coordinates in mm. pinnacle's y and z point the other way (the minus in pinnacleParser::parsePlan),
+			//which takes them to these same axes, so dicom only needs the cm.
+			auto pos = types::split<float>(*v, "\\");
+			if (pos.size() < 3) throw std::pair<int, string>(29, "IsocenterPosition of CP " + std::to_string(cpi) + " has " + std::to_string(pos.size()) + " values, expected 3.");
+			cp.beamInfo.isoCenter.x = pos[0] * mm;
+			cp.beamInfo.isoCenter.y = pos[1] * mm;
+			cp.beamInfo.isoCenter.z = pos[2] * mm;
+			if (cpi == 0) metaData.isoc = cp.beamInfo.isoCenter; //only the first CP must have it. setCPIs() gives every CP this one, as for pinnacle.
+		}
+		if (auto v = item.get("CumulativeMetersetWeight")) {
+			cp.beamInfo.relativeWeight = stof(*v) * weight_scale; //cumulative, setCPIs() makes it per CP
+		}
+
+		const auto &positions = item.sequence("BeamLimitingDevicePositionSequence");
+		for (size_t bldi = 0; bldi < positions.size(); bldi++){
+			auto v = positions[bldi].get("LeafJawPositions");
+			if (v == nullptr) continue;
+			auto pos = types::split<float>(*v, "\\");
+			for (auto &p : pos) p *= mm;
+			//the item names its device, older dumps only have the order of BeamLimitingDeviceSequence
+			auto type = positions[bldi].get("RTBeamLimitingDeviceType");
+			const string device = type ? *type : (bldi < BeamLimitingDeviceSequence.size() ? BeamLimitingDeviceSequence[bldi] : string());
+			if (device == "ASMX"){
+				cp.collimator.parallelJaw.j1 = { pos[0], pos[0] }; //J1 always most negative coord according to doc.
+				cp.beamInfo.fieldMin.first = pos[0] - metaData.fieldMargin;
+
+				cp.collimator.parallelJaw.j2 = { pos[1], pos[1] };
+				cp.beamInfo.fieldMax.first = pos[1] + metaData.fieldMargin;
+			}
+			if (device == "ASMY"){
+				cp.collimator.perpendicularJaw.j1 = { pos[0], pos[0] };
+				cp.beamInfo.fieldMin.second = pos[0] - metaData.fieldMargin;
+
+				cp.collimator.perpendicularJaw.j2 = { pos[1], pos[1] };
+				cp.beamInfo.fieldMax.second = pos[1] + metaData.fieldMargin;
+			}
+			if (device == "MLCX"){
+				if (int(pos.size()) < 2 * metaData.accelerator.leafs_per_bank) throw std::pair<int, string>(25, "Number of Leafs does not correspond to specified Accelerator.");
+				//pos heeft right bank eerst
+				for (int p = 0; p < metaData.accelerator.leafs_per_bank; p++){
+					cp.collimator.mlc.rightLeaves[p] = { pos[p], pos[p] };
+					cp.collimator.mlc.leftLeaves[p] = { pos[p + metaData.accelerator.leafs_per_bank], pos[p + metaData.accelerator.leafs_per_bank] };
 				}
-				continue;
+				//NOOT: for square fields dicom does not necesarily give MLCX positions. Only jaw positions may be encountered!!
 			}
-			continue;
 		}
 	}
 }
@@ -517,145 +576,163 @@ void pinnacleParser::parseBeam(const string &inFile) {
 		if (skip_n_lines > 0){
 			//it was set, so decrement and skip.
 			skip_n_lines--;
-			if (debug) fprintf(stderr,"RTPLan: skipping line: %s\n", line.second);
+			if (debug) fprintf(stderr,"RTPLan: skipping line: %s\n", line.second.c_str());
 			continue;
 		}
-		if (line.first == "isocentername"){
-			metaData.isocentername = line.second;
-			continue;
-		}
-		if (line.first == "machinenameandversion") {
-			if (startswith(line.second, "MLC160")){
-				metaData.accelerator = Accelerator(AcceleratorType::Agility);
-				continue;
-			}
-			else if (startswith(line.second, "M160")){
-				metaData.accelerator = Accelerator(AcceleratorType::Agility); //FFF?
-				continue;
-			}
-			else if (startswith(line.second, "MLC80")){
-				metaData.accelerator = Accelerator(AcceleratorType::MLCi80);
-				continue;
-			}
-			else if (startswith(line.second, "M80")){
-				metaData.accelerator = Accelerator(AcceleratorType::MLCi80);
-				continue;
-			}
-			else {
-				metaData.accelerator = Accelerator(AcceleratorType::UNKNOWN);
-				continue;
-			}
-		}
-		if (line.first == "machineenergyname") {
-			if (startswith(line.second, "6")){
-				metaData.accelerator.energy = Energy::MV6;
-			}
-			else if (startswith(line.second, "10")){
-				metaData.accelerator.energy = Energy::MV10;
-			}
-			else if (startswith(line.second, "7")){ //cant happen I guess
-				metaData.accelerator.energy = Energy::MV7;
-			}
-			else {
-				metaData.accelerator.energy = Energy::UNKNOWN;
-				metaData.accelerator.filter = Filter::UNKNOWN;
-			}
-			if (endswith(line.second, "FFF")){
-				metaData.accelerator.filter = Filter::NoFF;
-				//TODO: imrtfilter="Compensator" == FFF?
+		//one hash of the key up to its first separator (or of the bare name for keys matched on a plain prefix) picks the branch, cases check the key itself
+		const string &key = line.first;
+		switch (key_hash(key_prefix(key, { "setbeamtype", "weight" }))) {
+		case key_hash("isocentername"):
+			if (key == "isocentername"){
+				metaData.isocentername = line.second;
 			}
 			continue;
-		}
-		if (line.first == "numberofcontrolpoints") {
-			controlPoints.resize(stoi(line.second));
-			for (int i = 0; i < stoi(line.second); i++){
-				controlPoints[i].collimator.mlc.leftLeaves.resize(metaData.accelerator.leafs_per_bank); // leaf_per_bank should be set before
-				controlPoints[i].collimator.mlc.rightLeaves.resize(metaData.accelerator.leafs_per_bank);
+		case key_hash("machinenameandversion"):
+			if (key == "machinenameandversion") {
+				if (startswith(line.second, "MLC160")){
+					metaData.accelerator = Accelerator(AcceleratorType::Agility);
+				}
+				else if (startswith(line.second, "M160")){
+					metaData.accelerator = Accelerator(AcceleratorType::Agility); //FFF?
+				}
+				else if (startswith(line.second, "MLC80")){
+					metaData.accelerator = Accelerator(AcceleratorType::MLCi80);
+				}
+				else if (startswith(line.second, "M80")){
+					metaData.accelerator = Accelerator(AcceleratorType::MLCi80);
+				}
+				else {
+					metaData.accelerator = Accelerator(AcceleratorType::UNKNOWN);
+				}
 			}
 			continue;
-		}
-		if (startswith(line.first, "gantry[")) {
-			controlPoints[get_index(line.first)].beamInfo.gantryAngle = { stof(line.second), stof(line.second) };
-			continue;
-		}
-		if (startswith(line.first, "couch[")) {
-			controlPoints[get_index(line.first)].beamInfo.couchAngle = { 360-stof(line.second), 360-stof(line.second) };
-			// we doen 360 - waarde, want Pinnacle...
+		case key_hash("machineenergyname"):
+			if (key == "machineenergyname") {
+				if (startswith(line.second, "6")){
+					metaData.accelerator.energy = Energy::MV6;
+				}
+				else if (startswith(line.second, "10")){
+					metaData.accelerator.energy = Energy::MV10;
+				}
+				else if (startswith(line.second, "7")){ //cant happen I guess
+					metaData.accelerator.energy = Energy::MV7;
+				}
+				else {
+					metaData.accelerator.energy = Energy::UNKNOWN;
+					metaData.accelerator.filter = Filter::UNKNOWN;
+				}
+				if (endswith(line.second, "FFF")){
+					metaData.accelerator.filter = Filter::NoFF;
+					//TODO: imrtfilter="Compensator" == FFF?
+				}
+			}
 			continue;
-		}
-		if (startswith(line.first, "collimator[")) {
-			controlPoints[get_index(line.first)].beamInfo.collimatorAngle = { stof(line.second), stof(line.second) };
+		case key_hash("numberofcontrolpoints"):
+			if (key == "numberofcontrolpoints") {
+				controlPoints.resize(stoi(line.second));
+				for (int i = 0; i < stoi(line.second); i++){
+					controlPoints[i].collimator.mlc.leftLeaves.resize(metaData.accelerator.leafs_per_bank); // leaf_per_bank should be set before
+					controlPoints[i].collimator.mlc.rightLeaves.resize(metaData.accelerator.leafs_per_bank);
+				}
+			}
 			continue;
-		}
-		if (startswith(line.first, "setbeamtype")) {
-			if (startswith(line.second, "Dynamic Arc")){
-				metaData.beamtype = BeamType::VMAT;
+		case key_hash("gantry"):
+			if (startswith(key, "gantry[")) {
+				controlPoints[key_indices(key)[0]].beamInfo.gantryAngle = { stof(line.second), stof(line.second) };
 			}
-			else if (startswith(line.second, "Step & Shoot MLC")){
-				metaData.beamtype = BeamType::IMRT;
+			continue;
+		case key_hash("couch"):
+			if (startswith(key, "couch[")) {
+				controlPoints[key_indices(key)[0]].beamInfo.couchAngle = { 360-stof(line.second), 360-stof(line.second) };
+				// we doen 360 - waarde, want Pinnacle...
 			}
-			else if (startswith(line.second, "Static")){
-				metaData.beamtype = BeamType::IMRT;
+			continue;
+		case key_hash("collimator"):
+			if (startswith(key, "collimator[")) {
+				controlPoints[key_indices(key)[0]].beamInfo.collimatorAngle = { stof(line.second), stof(line.second) };
 			}
-			else {
-				metaData.beamtype = BeamType::UNKNOWN;
+			continue;
+		case key_hash("setbeamtype"):
+			if (startswith(key, "setbeamtype")) {
+				if (startswith(line.second, "Dynamic Arc")){
+					metaData.beamtype = BeamType::VMAT;
+				}
+				else if (startswith(line.second, "Step & Shoot MLC")){
+					metaData.beamtype = BeamType::IMRT;
+				}
+				else if (startswith(line.second, "Static")){
+					metaData.beamtype = BeamType::IMRT;
+				}
+				else {
+					metaData.beamtype = BeamType::UNKNOWN;
+				}
 			}
 			continue;
-		}
-		if (startswith(line.first, "numberofpoints[")) {
+		case key_hash("numberofpoints"):
 			//use as check.
-			if (stoi(line.second) == metaData.accelerator.leafs_per_bank){
-				continue; //all ok
-			}
-			else {
-				fprintf(stderr,"RTPLan: Invalid CPI detected: incorrect nr leafs: %s. Skipping CPI...\n", line.second);
+			if (startswith(key, "numberofpoints[") && stoi(line.second) != metaData.accelerator.leafs_per_bank) {
+				fprintf(stderr,"RTPLan: Invalid CPI detected: incorrect nr leafs: %s. Skipping CPI...\n", line.second.c_str());
 				skip_n_lines = stoi(line.second) * 2; //skip this nr*2 (pairs) of lines
-				continue;
-			}
-		}
-		if (startswith(line.first, "points_element[")) {
-			//loop backwards!
-			int cpi = get_index(line.first);
-			int leafindex = get_index(line.first, 2);
-			float pos = stof(line.second);
-			//fprintf(stderr,"points element %i %i %f\n", cpi, leafindex, pos);
-			if (leafindex % 2 == 0){ //even, dus leftbank
-				//std::cout << "left[" << cpi << "][" << leafindex / 2 << "] " << -pos;
-				controlPoints[cpi].collimator.mlc.leftLeaves[metaData.accelerator.leafs_per_bank - 1 - (leafindex / 2)] = { -pos, -pos }; //minus want vanaf het midden!
-			}
-			else{
-				//std::cout << "right[" << cpi << "][" << (leafindex - 1) / 2 << "] " << pos;
-				controlPoints[cpi].collimator.mlc.rightLeaves[metaData.accelerator.leafs_per_bank - 1 - ((leafindex - 1) / 2)] = { pos, pos };
 			}
 			continue;
-		}
-		if (startswith(line.first, "leftjawposition[")) {
-			controlPoints[get_index(line.first)].collimator.parallelJaw.j1 = { -stof(line.second), -stof(line.second) }; //J1 always most negative coord according to doc.
-			controlPoints[get_index(line.first)].beamInfo.fieldMin.first = -stof(line.second) - metaData.fieldMargin; // pinnacle gives distance to center of colli, so add minus
+		case key_hash("points"):
+			if (startswith(key, "points_element[")) {
+				//loop backwards!
+				auto index = key_indices(key);
+				int cpi = index[0];
+				int leafindex = index[1];
+				float pos = stof(line.second);
+				//fprintf(stderr,"points element %i %i %f\n", cpi, leafindex, pos);
+				if (leafindex % 2 == 0){ //even, dus leftbank
+					//std::cout << "left[" << cpi << "][" << leafindex / 2 << "] " << -pos;
+					controlPoints[cpi].collimator.mlc.leftLeaves[metaData.accelerator.leafs_per_bank - 1 - (leafindex / 2)] = { -pos, -pos }; //minus want vanaf het midden!
+				}
+				else{
+					//std::cout << "right[" << cpi << "][" << (leafindex - 1) / 2 << "] " << pos;
+					controlPoints[cpi].collimator.mlc.rightLeaves[metaData.accelerator.leafs_per_bank - 1 - ((leafindex - 1) / 2)] = { pos, pos };
+				}
+			}
 			continue;
-		}
-		if (startswith(line.first, "rightjawposition[")) {
-			controlPoints[get_index(line.first)].collimator.parallelJaw.j2 = { stof(line.second), stof(line.second) };
-			controlPoints[get_index(line.first)].beamInfo.fieldMax.first = stof(line.second) + metaData.fieldMargin;
+		case key_hash("leftjawposition"):
+			if (startswith(key, "leftjawposition[")) {
+				auto &cp = controlPoints[key_indices(key)[0]];
+				float pos = stof(line.second);
+				cp.collimator.parallelJaw.j1 = { -pos, -pos }; //J1 always most negative coord according to doc.
+				cp.beamInfo.fieldMin.first = -pos - metaData.fieldMargin; // pinnacle gives distance to center of colli, so add minus
+			}
 			continue;
-		}
-		if (startswith(line.first, "topjawposition[")) { //TRF reader: y axis swapped ? increases downward
-			controlPoints[get_index(line.first)].collimator.perpendicularJaw.j2 = { stof(line.second), stof(line.second) }; //J1 always most negative coord according to doc.
-			controlPoints[get_index(line.first)].beamInfo.fieldMax.second = stof(line.second) + metaData.fieldMargin;
+		case key_hash("rightjawposition"):
+			if (startswith(key, "rightjawposition[")) {
+				auto &cp = controlPoints[key_indices(key)[0]];
+				float pos = stof(line.second);
+				cp.collimator.parallelJaw.j2 = { pos, pos };
+				cp.beamInfo.fieldMax.first = pos + metaData.fieldMargin;
+			}
 			continue;
-		}
-		if (startswith(line.first, "bottomjawposition[")) {
-			controlPoints[get_index(line.first)].collimator.perpendicularJaw.j1 = { -stof(line.second), -stof(line.second) };
-			controlPoints[get_index(line.first)].beamInfo.fieldMin.second = -stof(line.second) - metaData.fieldMargin;
+		case key_hash("topjawposition"):
+			if (startswith(key, "topjawposition[")) { //TRF reader: y axis swapped ? increases downward
+				auto &cp = controlPoints[key_indices(key)[0]];
+				float pos = stof(line.second);
+				cp.collimator.perpendicularJaw.j2 = { pos, pos }; //J1 always most negative coord according to doc.
+				cp.beamInfo.fieldMax.second = pos + metaData.fieldMargin;
+			}
 			continue;
-		}
-		if (startswith(line.first, "weight[")) { //weight sums to one per beam.
-			controlPoints[get_index(line.first)].beamInfo.relativeWeight = stof(line.second); //relweight is relative to computation, so total should be 1, and per beam it is.
-			total_weight += stof(line.second);
+		case key_hash("bottomjawposition"):
+			if (startswith(key, "bottomjawposition[")) {
+				auto &cp = controlPoints[key_indices(key)[0]];
+				float pos = stof(line.second);
+				cp.collimator.perpendicularJaw.j1 = { -pos, -pos };
+				cp.beamInfo.fieldMin.second = -pos - metaData.fieldMargin;
+			}
 			continue;
-		}
-		if (startswith(line.first, "weight") && !startswith(line.first, "weight[")) { // beam weight, one per beam. summed over beams should be one.
-			metaData.weight = stof(line.second);
+		case key_hash("weight"):
+			if (startswith(key, "weight[")) { //weight sums to one per beam.
+				controlPoints[key_indices(key)[0]].beamInfo.relativeWeight = stof(line.second); //relweight is relative to computation, so total should be 1, and per beam it is.
+				total_weight += stof(line.second);
+			}
+			else { // beam weight, one per beam. summed over beams should be one.
+				metaData.weight = stof(line.second);
+			}
 			continue;
 		}
 	}
@@ -751,26 +828,83 @@ void dicomParser::setCPIs() {
 }
 
 
+vector<string> RTBeam::plan_beams(const string &plan_dir){
+	if (io::isfile(plan_dir + "/dbtype.dump")) return { plan_dir }; //a plan of one beam
+	vector<string> ret;
+	std::error_code ec;
+	for (const auto &entry : std::filesystem::directory_iterator(plan_dir, ec)){
+		if (entry.is_directory(ec) && io::isfile((entry.path() / "dbtype.dump").string())) ret.push_back(entry.path().string());
+	}
+	std::sort(ret.begin(), ret.end());
+	return ret;
+}
+
+
+vector<RTBeam> RTBeam::load_plan(const DosiaSettings &plan_sett, vector<std::pair<int, string>>* errors, unsigned int nthreads){
+	vector<string> dirs = plan_beams(plan_sett.rt_files);
+	if (dirs.empty()) throw std::pair<int, string>(20, "No beams found in " + plan_sett.rt_files + ".");
+
+	vector<RTBeam> ret(dirs.size());
+	vector<std::pair<int, string>> status(dirs.size(), { 0, "" });
+	DumpCache plan_dumps; //trial, plan and dose dumps, normally the same in every beam directory
+	{
+		//each beam parses its own beam.dump, the plan level dumps once per distinct contents
+		threads::ThreadPool pool(unsigned(std::min<size_t>(threads::count(nthreads), dirs.size())));
+		vector<std::future<void>> loaded;
+		for (size_t b = 0; b < dirs.size(); b++){
+			loaded.push_back(pool.submit([&, b]{
+				DosiaSettings beam_sett = plan_sett;
+				beam_sett.rt_files = dirs[b];
+				try {
+					ret[b] = RTBeam(beam_sett, &plan_dumps);
+				}
+				catch (const std::pair<int, string> &e) {
+					status[b] = e;
+				}
+				catch (const std::exception &e) { //malformed values (stof, stoi) and the like
+					status[b] = std::pair<int, string>(29, string("Problem parsing beam: ") + e.what());
+				}
+			}));
+		}
+		for (auto &l : loaded) l.get(); //anything else thrown is not a beam problem, let it through
+	}
+
+	if (errors != nullptr) *errors = status;
+	else {
+		for (size_t b = 0; b < dirs.size(); b++){
+			if (status[b].first != 0) throw std::pair<int, string>(status[b].first, dirs[b] + ": " + status[b].second);
+		}
+	}
+	return ret;
+}
+
+
 //RTBeam::RTBeam(const string &rt_files, float _fieldMargin, bool _debug, bool _pinnacleVMATmode) {
-RTBeam::RTBeam(DosiaSettings &_sett) : sett(_sett){
+RTBeam::RTBeam(DosiaSettings &_sett) : RTBeam(_sett, nullptr){
+}
+
+
+RTBeam::RTBeam(DosiaSettings &_sett, DumpCache* plan_dumps) : sett(_sett){
 	string &rt_files = sett.rt_files;
 	io::isfile(rt_files + "/dbtype.dump", 20);
 	auto dbtype = load_dump(sett.rt_files + "/dbtype.dump");
 	for (auto &line : dbtype) {
 		if (line.first == "pinnacle"){
 			auto parser = pinnacleParser(metaData, (sett.verbose > 1)?true:false);
-			parser.parseTrial(rt_files + "/trialname.dump");	//mu, nr_fracties, HU-intercept. NIET beschikbaar bij dicom
+			if (plan_dumps) parser.parseTrial(*plan_dumps->get(rt_files + "/trialname.dump"));
+			else parser.parseTrial(rt_files + "/trialname.dump");	//mu, nr_fracties, HU-intercept. NIET beschikbaar bij dicom
 			parser.parseBeam(rt_files + "/beam.dump");
-			parser.parsePlan(rt_files + "/plan.dump");	//isoc, requires info from beam!
+			if (plan_dumps) parser.parsePlan(*plan_dumps->get(rt_files + "/plan.dump"));
+			else parser.parsePlan(rt_files + "/plan.dump");	//isoc, requires info from beam!
 			parser.parseScan(rt_files + "/scan.dump");	//not needed
-			parser.parseDose(rt_files + "/dose.dump");
+			if (plan_dumps) parser.parseDose(*plan_dumps->get(rt_files + "/dose.dump"));
+			else parser.parseDose(rt_files + "/dose.dump");
 
 			parser.setCPIs();
 			metaData = parser.metaData;
 			controlPoints = parser.controlPoints;
 		}
 		else if (line.first == "dicom"){
-			throw std::pair<int, string>(28, "Dicom not fully implemented.");
 			auto parser = dicomParser(metaData, (sett.verbose > 1) ? true : false);
 			parser.parseTrial(rt_files + "/trialname.dump");	//NIET beschikbaar bij dicom
 			parser.parsePlan(rt_files + "/plan.dump");	//no required info?
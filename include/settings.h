@@ -1,5 +1,6 @@
 #pragma once
 
+#include <algorithm> //std::max
 #include "INIreader.h"
 #include "gpumcd/Settings.h"
 
@@ -24,6 +25,13 @@ public:
 	bool score_dose_to_water;
 	bool score_and_transport_in_water;
 	bool in_aqua_vivo;
+	float dose_grid_voxel_size; // cm, 0 computes on the ct grid
+	bool body_mask; // outside the patient outline is air, and the phantom is cropped to it. always on for in_aqua_vivo.
+	float body_mask_margin; // cm around the outline kept when cropping
+
+	unsigned int threads; // for preprocessing, 0 uses all cores
+	string phantom_cache_dir; // empty disables the cache
+	size_t phantom_cache_bytes;
 	
 	bool gamma_comparison;
 	bool gamma_global_dose;
@@ -55,6 +63,7 @@ DosiaSettings::DosiaSettings(const string &ini_file, const string & _rt_files) :
 	gpumcd_material_data_dir = ini.Get("directories", "gpumcd_material_data_dir", ".");
 	gpumcd_machine_dir = ini.Get("directories", "gpumcd_machine_dir", ".");
 	hounsfield_conversion_dir = ini.Get("directories", "hounsfield_conversion_dir", ".");
+	phantom_cache_dir = ini.Get("directories", "phantom_cache_dir", "");
 
 	MRLinac_MV7 = ini.Get("gpumcd_machines", "MRLinac_MV7", ".");
 	Agility_MV6_FF = ini.Get("gpumcd_machines", "Agility_MV6_FF", ".");
@@ -73,6 +82,12 @@ DosiaSettings::DosiaSettings(const string &ini_file, const string & _rt_files) :
 	score_dose_to_water = ini.GetBoolean("dose", "score_dose_to_water", false);
 	score_and_transport_in_water = ini.GetBoolean("dose", "score_and_transport_in_water", false);
 	in_aqua_vivo = ini.GetBoolean("dose", "in_aqua_vivo", false);
+	dose_grid_voxel_size = ini.GetReal("dose", "grid_voxel_size", 0.f) / 10.f; //mm in ini
+	body_mask = ini.GetBoolean("dose", "body_mask", false);
+	body_mask_margin = ini.GetReal("dose", "body_mask_margin", 10.f) / 10.f; //mm in ini
+
+	threads = std::max(0L, ini.GetInteger("performance", "threads", 0));
+	phantom_cache_bytes = static_cast<size_t>(ini.GetReal("performance", "phantom_cache_mb", 4096) * 1024 * 1024);
 
 	gamma_comparison = ini.GetBoolean("gamma", "comparison", false);
 	gamma_global_dose = ini.GetBoolean("gamma", "global_dose", true);
@@ -104,12 +119,14 @@ DosiaSettings::DosiaSettings(const string &ini_file, const string & _rt_files) :
 		cerr << "dose_per_fraction = " << dose_per_fraction << ".\n";
 		cerr << "pinnacle_vmat_interpolation = " << pinnacle_vmat_interpolation << ".\n";
 		cerr << "monte_carlo_high_precision = " << monte_carlo_high_precision << ".\n";
+		if (dose_grid_voxel_size > 0) cerr << "Dose computed on a grid of " << dose_grid_voxel_size * 10 << "mm voxels.\n";
+		if (threads > 0) cerr << "Preprocessing on " << threads << " threads.\n";
+		if (!phantom_cache_dir.empty()) cerr << "Phantoms cached in " << phantom_cache_dir << ", up to " << phantom_cache_bytes / 1024 / 1024 << "MB.\n";
 
 		if (gamma_comparison) cerr << "Gamma comparison enabled.\n";
 		if (dbgoutput) cerr << "Debug outputs will be written to disk.\n";
-		//if (in_aqua_vivo) cerr << "Forcing all densities inside patient threshold to 1.0g/cm3 (as EpidTrial.py in Pinnacle).\n";
-		if (in_aqua_vivo) cerr << "in_aqua_vivo currently not correctly implemented. Will be removed. Dosia dump should fix this.\n";
-		if (in_aqua_vivo) in_aqua_vivo = false;
+		if (body_mask || in_aqua_vivo) cerr << "Phantom cropped to the patient outline plus " << body_mask_margin * 10 << "mm, air outside it.\n";
+		if (in_aqua_vivo) cerr << "Forcing all densities inside patient threshold to 1.0g/cm3 (as EpidTrial.py in Pinnacle).\n";
 
 		if (score_and_transport_in_water) { cerr << "Computing dose and transport in water instead of medium.\n"; }
 		else if (score_dose_to_water) { cerr << "Computing dose to water instead of medium.\n"; };
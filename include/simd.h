@@ -0,0 +1,200 @@
+#pragma once
+
+#include <cstddef> //size_t
+#include <cstdint>
+#include <cstring> //std::memcpy
+
+/*
+ * Byte swap kernels for big endian (xdr) voxels, and a fused swap and convert for decoding xdr_short to floats.
+ * AVX2 and SSSE3 versions with a scalar fallback, picked once at runtime.
+ * in and out may be the same buffer for the swaps, not for the conversion.
+ * there is no float to xdr_short kernel: images keep their file type, so write_xdr only ever swaps shorts.
+ */
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SIMD_TARGET(x)
+#else
+#include <immintrin.h>
+#include <cpuid.h>
+#define SIMD_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
+
+namespace simd {
+
+	namespace scalar {
+		void swap16(const void* in, void* out, size_t n){
+			const uint8_t* i8 = static_cast<const uint8_t*>(in);
+			uint8_t* o8 = static_cast<uint8_t*>(out);
+			for (size_t i = 0; i < n; i++){
+				uint8_t a = i8[2 * i], b = i8[2 * i + 1];
+				o8[2 * i] = b;
+				o8[2 * i + 1] = a;
+			}
+		}
+
+		void swap32(const void* in, void* out, size_t n){
+			const uint8_t* i8 = static_cast<const uint8_t*>(in);
+			uint8_t* o8 = static_cast<uint8_t*>(out);
+			for (size_t i = 0; i < n; i++){
+				uint8_t a = i8[4 * i], b = i8[4 * i + 1], c = i8[4 * i + 2], d = i8[4 * i + 3];
+				o8[4 * i] = d;
+				o8[4 * i + 1] = c;
+				o8[4 * i + 2] = b;
+				o8[4 * i + 3] = a;
+			}
+		}
+
+		void be_i16_to_f32(const void* in, float* out, size_t n){
+			const uint8_t* i8 = static_cast<const uint8_t*>(in);
+			for (size_t i = 0; i < n; i++){
+				out[i] = static_cast<int16_t>((i8[2 * i] << 8) | i8[2 * i + 1]);
+			}
+		}
+	}
+
+#ifdef SIMD_X86
+	namespace ssse3 {
+		SIMD_TARGET("ssse3")
+		void swap16(const void* in, void* out, size_t n){
+			const char* i8 = static_cast<const char*>(in);
+			char* o8 = static_cast<char*>(out);
+			const __m128i mask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8){
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(i8 + 2 * i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(o8 + 2 * i), _mm_shuffle_epi8(v, mask));
+			}
+			scalar::swap16(i8 + 2 * i, o8 + 2 * i, n - i);
+		}
+
+		SIMD_TARGET("ssse3")
+		void swap32(const void* in, void* out, size_t n){
+			const char* i8 = static_cast<const char*>(in);
+			char* o8 = static_cast<char*>(out);
+			const __m128i mask = _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+			size_t i = 0;
+			for (; i + 4 <= n; i += 4){
+				__m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(i8 + 4 * i));
+				_mm_storeu_si128(reinterpret_cast<__m128i*>(o8 + 4 * i), _mm_shuffle_epi8(v, mask));
+			}
+			scalar::swap32(i8 + 4 * i, o8 + 4 * i, n - i);
+		}
+
+		SIMD_TARGET("ssse3")
+		void be_i16_to_f32(const void* in, float* out, size_t n){
+			const char* i8 = static_cast<const char*>(in);
+			const __m128i mask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8){
+				__m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(i8 + 2 * i)), mask);
+				//sign extend by unpacking into the high half and shifting back
+				__m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+				__m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+				_mm_storeu_ps(out + i, _mm_cvtepi32_ps(lo));
+				_mm_storeu_ps(out + i + 4, _mm_cvtepi32_ps(hi));
+			}
+			scalar::be_i16_to_f32(i8 + 2 * i, out + i, n - i);
+		}
+	}
+
+	namespace avx2 {
+		SIMD_TARGET("avx2")
+		void swap16(const void* in, void* out, size_t n){
+			const char* i8 = static_cast<const char*>(in);
+			char* o8 = static_cast<char*>(out);
+			const __m256i mask = _mm256_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14,
+				1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+			size_t i = 0;
+			for (; i + 16 <= n; i += 16){
+				__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(i8 + 2 * i));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(o8 + 2 * i), _mm256_shuffle_epi8(v, mask));
+			}
+			scalar::swap16(i8 + 2 * i, o8 + 2 * i, n - i);
+		}
+
+		SIMD_TARGET("avx2")
+		void swap32(const void* in, void* out, size_t n){
+			const char* i8 = static_cast<const char*>(in);
+			char* o8 = static_cast<char*>(out);
+			const __m256i mask = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+				3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8){
+				__m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(i8 + 4 * i));
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(o8 + 4 * i), _mm256_shuffle_epi8(v, mask));
+			}
+			scalar::swap32(i8 + 4 * i, o8 + 4 * i, n - i);
+		}
+
+		SIMD_TARGET("avx2")
+		void be_i16_to_f32(const void* in, float* out, size_t n){
+			const char* i8 = static_cast<const char*>(in);
+			const __m128i mask = _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14);
+			size_t i = 0;
+			for (; i + 8 <= n; i += 8){
+				__m128i v = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(i8 + 2 * i)), mask);
+				_mm256_storeu_ps(out + i, _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(v)));
+			}
+			scalar::be_i16_to_f32(i8 + 2 * i, out + i, n - i);
+		}
+	}
+#endif
+
+	struct Kernels {
+		void(*swap16)(const void*, void*, size_t);
+		void(*swap32)(const void*, void*, size_t);
+		void(*be_i16_to_f32)(const void*, float*, size_t);
+	};
+
+	enum class Level { SCALAR, SSSE3, AVX2 };
+
+	Level detect(){
+#ifdef SIMD_X86
+#ifdef _MSC_VER
+		int info[4];
+		__cpuid(info, 0);
+		int nids = info[0];
+		__cpuid(info, 1);
+		bool ssse3 = (info[2] & (1 << 9)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx2 = false;
+		if (nids >= 7 && osxsave && (_xgetbv(0) & 0x6) == 0x6){ //os saves ymm registers
+			__cpuidex(info, 7, 0);
+			avx2 = (info[1] & (1 << 5)) != 0;
+		}
+		if (avx2) return Level::AVX2;
+		if (ssse3) return Level::SSSE3;
+#else
+		__builtin_cpu_init();
+		if (__builtin_cpu_supports("avx2")) return Level::AVX2;
+		if (__builtin_cpu_supports("ssse3")) return Level::SSSE3;
+#endif
+#endif
+		return Level::SCALAR;
+	}
+
+	const Kernels &kernels(){
+		static const Kernels k = []{
+#ifdef SIMD_X86
+			switch (detect()){
+			case Level::AVX2: return Kernels{ avx2::swap16, avx2::swap32, avx2::be_i16_to_f32 };
+			case Level::SSSE3: return Kernels{ ssse3::swap16, ssse3::swap32, ssse3::be_i16_to_f32 };
+			default: break;
+			}
+#endif
+			return Kernels{ scalar::swap16, scalar::swap32, scalar::be_i16_to_f32 };
+		}();
+		return k;
+	}
+
+	// >i2 <-> <i2, n elements
+	void swap16(const void* in, void* out, size_t n){ kernels().swap16(in, out, n); }
+	// >f4 <-> <f4 (or any 4 byte type), n elements
+	void swap32(const void* in, void* out, size_t n){ kernels().swap32(in, out, n); }
+	// xdr_short to float, n elements
+	void be_i16_to_f32(const void* in, float* out, size_t n){ kernels().be_i16_to_f32(in, out, n); }
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <functional> //std::function
+#include <memory> //std::shared_ptr
+#include <queue>
+#include <vector>
+#include <exception>
+#include <algorithm> //std::min
+
+/*
+ * Needs C++17 like the rest of include/, and the platform threads library (-pthread with gcc and clang).
+ */
+
+namespace threads {
+	//nr of threads to use, 0 means all cores
+	unsigned int count(unsigned int requested = 0){
+		if (requested > 0) return requested;
+		unsigned int hw = std::thread::hardware_concurrency();
+		return hw > 0 ? hw : 1;
+	}
+
+	//fixed set of threads working through a queue. results and exceptions come back through futures.
+	class ThreadPool {
+	public:
+		ThreadPool(unsigned int = 0); //nthreads, 0 means all cores
+		~ThreadPool(); //finishes what was queued, then joins
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool &operator=(const ThreadPool &) = delete;
+
+		template <typename F>
+		auto submit(F &&) -> std::future<decltype(std::declval<F>()())>;
+		void post(std::function<void()>); //fire and forget, the task handles its own errors
+		size_t size() const { return workers.size(); };
+
+		static ThreadPool &shared(); //one per process on all cores, for parallel_for. joined at exit.
+
+	private:
+		std::vector<std::thread> workers;
+		std::queue<std::function<void()>> tasks;
+		std::mutex tasks_mutex;
+		std::condition_variable tasks_cv;
+		bool stopping = false;
+	};
+
+	ThreadPool::ThreadPool(unsigned int nthreads){
+		for (unsigned int t = 0; t < count(nthreads); t++){
+			workers.emplace_back([this]{
+				while (true){
+					std::function<void()> task;
+					{
+						std::unique_lock<std::mutex> lock(tasks_mutex);
+						tasks_cv.wait(lock, [this]{ return stopping || !tasks.empty(); });
+						if (tasks.empty()) return; //stopping and nothing left
+						task = std::move(tasks.front());
+						tasks.pop();
+					}
+					task();
+				}
+			});
+		}
+	}
+
+	ThreadPool::~ThreadPool(){
+		{
+			std::lock_guard<std::mutex> lock(tasks_mutex);
+			stopping = true;
+		}
+		tasks_cv.notify_all();
+		for (auto &w : workers) w.join();
+	}
+
+	void ThreadPool::post(std::function<void()> task){
+		{
+			std::lock_guard<std::mutex> lock(tasks_mutex);
+			tasks.push(std::move(task));
+		}
+		tasks_cv.notify_one();
+	}
+
+	ThreadPool &ThreadPool::shared(){
+		static ThreadPool pool;
+		return pool;
+	}
+
+	template <typename F>
+	auto ThreadPool::submit(F &&f) -> std::future<decltype(std::declval<F>()())> {
+		using R = decltype(std::declval<F>()());
+		auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(f)); //std::function needs copyable
+		std::future<R> ret = task->get_future();
+		post([task]{ (*task)(); });
+		return ret;
+	}
+
+	//calls f(i) for every i in [0, n) on up to nthreads threads, the caller being one of them.
+	//which thread gets which i is not fixed, so f(i) should only depend on i. the first exception thrown is rethrown here.
+	//the helpers come from ThreadPool::shared(), so repeated calls start no threads and nested calls (a parallel_for in f,
+	//or in a task of another pool) only get the workers that are idle: the caller does whatever nobody else picks up.
+	template <typename F>
+	void parallel_for(size_t n, F &&f, unsigned int nthreads = 0){
+		size_t nworkers = std::min<size_t>(count(nthreads), n);
+		if (nworkers <= 1){
+			for (size_t i = 0; i < n; i++) f(i);
+			return;
+		}
+
+		//helpers may start after we returned, so what they share with us outlives this call. they only touch f while busy.
+		struct State {
+			std::atomic<size_t> next{ 0 };
+			size_t busy = 0;
+			std::exception_ptr error;
+			std::mutex mutex;
+			std::condition_variable idle;
+		};
+		auto state = std::make_shared<State>();
+		auto work = [n, &f](State &st){
+			try {
+				for (size_t i = st.next++; i < n; i = st.next++) f(i);
+			}
+			catch (...) {
+				std::lock_guard<std::mutex> lock(st.mutex);
+				if (!st.error) st.error = std::current_exception();
+				st.next = n; //others stop after their current i
+			}
+		};
+
+		ThreadPool &pool = ThreadPool::shared();
+		for (size_t t = 1; t < std::min(nworkers, pool.size() + 1); t++){
+			pool.post([state, work, n]{
+				{
+					std::lock_guard<std::mutex> lock(state->mutex);
+					if (state->next >= n) return; //all taken, the caller may be gone already
+					state->busy++;
+				}
+				work(*state);
+				std::lock_guard<std::mutex> lock(state->mutex);
+				if (--state->busy == 0) state->idle.notify_all();
+			});
+		}
+		work(*state);
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->idle.wait(lock, [&]{ return state->busy == 0; });
+		if (state->error) std::rethrow_exception(state->error);
+	}
+}
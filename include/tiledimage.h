@@ -0,0 +1,178 @@
+#pragma once
+
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include "image.h"
+
+/*
+ * Out of core access to a 3D .xdr or .mhd: the volume is split in z-slabs of a few slices,
+ * each read (as floats) on first touch and evicted least recently used once the resident slabs exceed a byte budget.
+ * A slab is an Image with its own geometry, so the usual views and loops work on it.
+ * Block compressed .mhd (see Image::write) is supported, a single zlib stream cannot be read partially.
+ * This is a reader next to Image rather than a storage backend behind it: Image hands out contiguous voxels (data<T>(), views,
+ * visit()) and the phantom and dose code depends on that. Out of core work goes slab by slab through slab() or for_each_slab(),
+ * each slab a plain Image, so the lock is taken once per slab and never per voxel.
+ */
+
+class TiledImage {
+public:
+	TiledImage(const std::string &, size_t = size_t(256) << 20, int = 0); //fname, budget in bytes, slices per slab (0: budget/8)
+	TiledImage(const TiledImage &) = delete;
+	TiledImage &operator=(const TiledImage &) = delete;
+
+	struct Stats {
+		size_t loads = 0;
+		size_t hits = 0;
+		size_t evictions = 0;
+		size_t resident_bytes = 0;
+	};
+
+	const ImageInfo &info() const { return header; };
+	Image geometry() const; //of the whole volume, without voxels
+	int nslabs() const { return (header.dim_size[2] + depth - 1) / depth; };
+	int slab_depth() const { return depth; };
+	int slab_first_z(int s) const { return s * depth; };
+
+	std::shared_ptr<const Image> slab(int); //loads if needed. stays valid while held, even when evicted.
+	template <typename F> void for_each_slab(F &&); //f(const Image &slab, int first_z), in z order
+	Stats stats() const;
+
+private:
+	ImageInfo header;
+	size_t budget;
+	int depth;
+	mutable std::shared_ptr<io::mmap_file> zraw; //compressed files only, mapped on first use
+
+	using Entry = std::pair<std::shared_ptr<const Image>, std::list<int>::iterator>;
+	std::unordered_map<int, Entry> resident;
+	std::list<int> lru; //front is most recently used
+	Stats counters;
+	mutable std::mutex slabs_mutex;
+
+	std::shared_ptr<Image> load(int) const;
+};
+
+
+TiledImage::TiledImage(const std::string &fname, size_t _budget, int _depth) : header(Image::probe(fname)), budget(_budget), depth(_depth){
+	if (header.ndim() != 3){
+		throw std::pair<int, std::string>(79, "Tiled access needs a 3D image, '" + fname + "' is not.");
+	}
+	if (header.compressed && (header.block_size == 0 || header.block_offsets.empty())){
+		throw std::pair<int, std::string>(79, "Tiled access needs an uncompressed or block compressed image, '" + fname + "' is one zlib stream.");
+	}
+	size_t slice_bytes = size_t(header.dim_size[0]) * header.dim_size[1] * sizeof(float);
+	if (depth <= 0) depth = int(std::max<size_t>(1, budget / 8 / slice_bytes));
+	depth = std::min(depth, header.dim_size[2]);
+}
+
+
+Image TiledImage::geometry() const {
+	Image ret;
+	ret.dim_size = header.dim_size;
+	ret.voxel_sizes = header.voxel_sizes;
+	ret.min_ext = header.min_ext;
+	ret.max_ext = header.max_ext;
+	return ret;
+}
+
+
+std::shared_ptr<const Image> TiledImage::slab(int s){
+	assert(s >= 0 && s < nslabs());
+	{
+		std::lock_guard<std::mutex> lock(slabs_mutex);
+		auto found = resident.find(s);
+		if (found != resident.end()){
+			counters.hits++;
+			lru.splice(lru.begin(), lru, found->second.second);
+			return found->second.first;
+		}
+	}
+
+	//read outside the lock, so other slabs can be served meanwhile. two threads may read the same slab, the first one in wins.
+	std::shared_ptr<const Image> loaded = load(s);
+	size_t nbytes = loaded->imdata.size() * sizeof(float);
+
+	std::lock_guard<std::mutex> lock(slabs_mutex);
+	auto found = resident.find(s);
+	if (found != resident.end()){
+		lru.splice(lru.begin(), lru, found->second.second);
+		return found->second.first;
+	}
+	counters.loads++;
+	lru.push_front(s);
+	resident[s] = Entry(loaded, lru.begin());
+	counters.resident_bytes += nbytes;
+	while (counters.resident_bytes > budget && lru.size() > 1){
+		int victim = lru.back();
+		counters.resident_bytes -= resident[victim].first->imdata.size() * sizeof(float);
+		resident.erase(victim);
+		lru.pop_back();
+		counters.evictions++;
+	}
+	return loaded;
+}
+
+
+template <typename F>
+void TiledImage::for_each_slab(F &&f){
+	for (int s = 0; s < nslabs(); s++){
+		auto current = slab(s);
+		f(*current, slab_first_z(s));
+	}
+}
+
+
+TiledImage::Stats TiledImage::stats() const {
+	std::lock_guard<std::mutex> lock(slabs_mutex);
+	return counters;
+}
+
+
+std::shared_ptr<Image> TiledImage::load(int s) const {
+	int z0 = slab_first_z(s);
+	int nz = std::min(depth, header.dim_size[2] - z0);
+	size_t slice_bytes = size_t(header.dim_size[0]) * header.dim_size[1] * types::voxel_size(header.type);
+
+	ImageInfo part = header;
+	part.dim_size[2] = nz;
+	part.min_ext[2] = header.min_ext[2] + z0 * header.voxel_sizes[2];
+	part.max_ext[2] = part.min_ext[2] + header.voxel_sizes[2] * (nz - 1);
+
+	auto ret = std::make_shared<Image>();
+	if (!header.compressed){
+		part.offset += z0 * slice_bytes;
+		ret->read(part, ImageLoad::FLOAT);
+		return ret;
+	}
+
+	//inflate only the blocks overlapping the slab, copy out the overlap
+	std::shared_ptr<io::mmap_file> file;
+	{
+		std::lock_guard<std::mutex> lock(slabs_mutex);
+		if (!zraw) zraw = std::make_shared<io::mmap_file>(header.datafile);
+		file = zraw;
+	}
+	size_t total = header.nbytes(), bs = header.block_size;
+	size_t compressed_size = header.compressed_size > 0 ? header.compressed_size : file->size();
+	size_t first = z0 * slice_bytes, last = first + nz * slice_bytes; //[first, last) of the raw bytes
+
+	ret->dim_size = part.dim_size;
+	ret->voxel_sizes = part.voxel_sizes;
+	ret->min_ext = part.min_ext;
+	ret->max_ext = part.max_ext;
+	ret->allocate(header.type);
+	char* dest = ret->owned_bytes();
+	vector<char> block(bs);
+	for (size_t b = first / bs; b * bs < last; b++){
+		size_t begin = header.block_offsets[b];
+		size_t end = b + 1 < header.block_offsets.size() ? header.block_offsets[b + 1] : compressed_size;
+		size_t n = std::min(bs, total - b * bs);
+		Image::inflate(file->data() + begin, end - begin, block.data(), n, header.datafile, header.blocks_in_one_stream()); //no checksum per slab
+		size_t lo = std::max(first, b * bs), hi = std::min(last, b * bs + n);
+		std::memcpy(dest + (lo - first), block.data() + (lo - b * bs), hi - lo);
+	}
+	ret->floats();
+	return ret;
+}
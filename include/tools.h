@@ -10,9 +10,37 @@
 #include <assert.h>
 #include <sstream> //stringstream
 #include <cstring> //std::memcpy
+#include <cstdint>
+#include <type_traits> //std::is_floating_point
+#include <cmath> //std::ldexp, std::nearbyint
+#include <memory> //std::shared_ptr
+#include <string_view>
+#include <array>
+#include <initializer_list>
+#include <map>
+#include <charconv> //std::from_chars
+#include <stdexcept> //std::invalid_argument
+#include <cctype> //std::tolower
 #include "pystring.h"
+#include "simd.h"
+#include "vectexpr.h" //lazy, into
+#include "vectreduce.h" //reduce::sum, dot, minmax
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h> //CreateFileMapping
+#else
+#include <sys/mman.h> //mmap
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #pragma warning(disable : 4996) // disable fopen warning vs
 
+/*
+ * Needs C++17: string_view, from_chars, if constexpr (here and in vectexpr.h/vectreduce.h).
+ * vectreduce.h runs on threads.h, so link with the platform threads library (-pthread).
+ */
+
 namespace vect {
 	using std::vector;
 
@@ -39,6 +67,86 @@ namespace vect {
 		return yL + gradient * (x - xL); // linear interpolation
 	};
 
+	//interpolate() with the table prepared once: slopes precomputed and a binary search instead of the scan.
+	//results are bit for bit those of interpolate(xData, yData, x, extrapolate). xData must be ascending.
+	class PiecewiseLinear {
+	public:
+		PiecewiseLinear() = default;
+		template <typename T, typename U>
+		PiecewiseLinear(const vector<T> &, const vector<U> &, const bool); //xData, yData, extrapolate
+
+		template <typename V>
+		double operator()(const V &) const;
+		template <typename V, typename R>
+		void evaluate(const V*, R*, size_t) const; //in, out, n
+		template <typename V, typename R>
+		void evaluate(const vector<V> &, vector<R> &) const; //out is resized to in
+
+		size_t size() const { return xs.size(); };
+
+	private:
+		vector<double> xs, ys;
+		vector<double> slopes; //of each interval
+		bool extrapolate = true;
+		double slope_below = 0., slope_above = 0.; //flat ends when not extrapolating, as interpolate() computes them
+
+		template <typename V> size_t interval(const V &) const;
+		template <typename V> double at(const V &, size_t) const; //value at x in interval i
+	};
+
+	template <typename T, typename U>
+	PiecewiseLinear::PiecewiseLinear(const vector<T> &xData, const vector<U> &yData, const bool _extrapolate) : xs(xData.begin(), xData.end()), ys(yData.begin(), yData.end()), extrapolate(_extrapolate){
+		assert(xs.size() >= 2 && xs.size() == ys.size());
+		size_t n = xs.size();
+		slopes.resize(n - 1);
+		for (size_t i = 0; i < n - 1; i++) slopes[i] = (ys[i + 1] - ys[i]) / (xs[i + 1] - xs[i]);
+		slope_below = (ys[0] - ys[0]) / (xs[1] - xs[0]);
+		slope_above = (ys[n - 1] - ys[n - 1]) / (xs[n - 1] - xs[n - 2]);
+	}
+
+	template <typename V>
+	size_t PiecewiseLinear::interval(const V &x) const {
+		//left end of the interval, picked as interpolate() does: n - 2 when x >= xs[n - 2], else the first i with x <= xs[i + 1].
+		//branchless binary search over xs[1, n - 2]: the loop count depends only on n and the steps compile to cmovs.
+		const size_t n = xs.size();
+		const double* first = xs.data() + 1;
+		size_t len = n - 2;
+		while (len > 1) {
+			size_t half = len / 2;
+			first = (x > first[half]) ? first + half : first;
+			len -= half;
+		}
+		size_t below = (first - xs.data()) + ((x > *first) ? 1 : 0) - 1; //nr of xs[1, n - 2] below x
+		return (x >= xs[n - 2]) ? n - 2 : below;
+	}
+
+	template <typename V>
+	double PiecewiseLinear::at(const V &x, size_t i) const {
+		double xL = xs[i];
+		if (!extrapolate) {
+			if (x < xL) return ys[i] + slope_below * (x - xL);
+			if (x > xs[i + 1]) return ys[i + 1] + slope_above * (x - xL);
+		}
+		return ys[i] + slopes[i] * (x - xL);
+	}
+
+	template <typename V>
+	double PiecewiseLinear::operator()(const V &x) const {
+		return at(x, interval(x));
+	}
+
+	template <typename V, typename R>
+	void PiecewiseLinear::evaluate(const V* in, R* out, size_t n) const {
+		//no branch depends on the data when extrapolating, so voxels overlap in the pipeline
+		for (size_t i = 0; i < n; i++) out[i] = R(at(in[i], interval(in[i])));
+	}
+
+	template <typename V, typename R>
+	void PiecewiseLinear::evaluate(const vector<V> &in, vector<R> &out) const {
+		out.resize(in.size());
+		evaluate(in.data(), out.data(), in.size());
+	}
+
 	template <typename T>
 	vector<size_t> sort_indexes(const vector<T> &v) {
 		// src: https://stackoverflow.com/questions/1577475/c-sorting-and-keeping-track-of-indexes#12399290
@@ -63,12 +171,17 @@ namespace vect {
 	}
 
 	template <typename T>
-	T sum(vector<T> &v){
-		T sum = 0;
-		for (const auto &i : v) {
-			sum += i;
+	T sum(const vector<T> &v){
+		if constexpr (std::is_floating_point<T>::value) {
+			return T(reduce::sum(v)); //accumulates in double, reproducibly. see vectreduce.h
+		}
+		else {
+			T sum = 0; //integers are exact as they are, a double would round them above 2^53
+			for (const auto &i : v) {
+				sum += i;
+			}
+			return sum;
 		}
-		return sum;
 	}
 
 	template <typename T>
@@ -80,27 +193,21 @@ namespace vect {
 	template <typename T>
 	vector<T> add(const vector<T> &v1, const vector<T> &v2){
 		assert(v1.size() == v2.size());
-		vector<T> v3(v1.size());
-		std::transform(v1.begin(), v1.end(), v2.begin(), v3.begin(), std::plus<T>());
-		return v3;
+		return eval(lazy(v1) + lazy(v2)); //chain lazy() operands instead to fuse several ops
 	}
 
 	//element wise subtract two vectors
 	template <typename T>
 	vector<T> sub(const vector<T> &v1, const vector<T> &v2){
 		assert(v1.size() == v2.size());
-		vector<T> v3(v1.size());
-		std::transform(v1.begin(), v1.end(), v2.begin(), v3.begin(), std::minus<T>());
-		return v3;
+		return eval(lazy(v1) - lazy(v2)); //chain lazy() operands instead to fuse several ops
 	}
 
 	//element wise multiply two vectors
 	template <typename T>
 	vector<T> mul(const vector<T> &v1, const vector<T> &v2){
 		assert(v1.size() == v2.size());
-		vector<T> v3(v1.size());
-		std::transform(v1.begin(), v1.end(), v2.begin(), v3.begin(), std::multiplies<T>());
-		return v3;
+		return eval(lazy(v1) * lazy(v2)); //chain lazy() operands instead to fuse several ops
 	}
 
 	//multiply elements of vector
@@ -117,9 +224,7 @@ namespace vect {
 	template <typename T>
 	vector<T> div(const vector<T> &v1, const vector<T> &v2){
 		assert(v1.size() == v2.size());
-		vector<T> v3(v1.size());
-		std::transform(v1.begin(), v1.end(), v2.begin(), v3.begin(), std::divides<T>());
-		return v3;
+		return eval(lazy(v1) / lazy(v2)); //chain lazy() operands instead to fuse several ops
 	}
 
 	//write vector to binary file
@@ -233,9 +338,195 @@ namespace io {
 		if (!isfile(filename)) throw std::pair<int, std::string>(errcode, "Failed to load " + filename + ".");
 		return true; //if no throw, then OK!
 	}
+
+	//fseek and ftell with 64 bit offsets, long is 32 bits on windows
+	int seek(FILE* ffile, int64_t offset, int origin){
+#ifdef _WIN32
+		return _fseeki64(ffile, offset, origin);
+#else
+		return fseeko(ffile, off_t(offset), origin);
+#endif
+	}
+
+	int64_t tell(FILE* ffile){
+#ifdef _WIN32
+		return _ftelli64(ffile);
+#else
+		return int64_t(ftello(ffile));
+#endif
+	}
+
+	//read-only mapping of a whole file. not copyable, so share it with a shared_ptr.
+	class mmap_file {
+	public:
+		mmap_file(const std::string &);
+		~mmap_file();
+		mmap_file(const mmap_file &) = delete;
+		mmap_file &operator=(const mmap_file &) = delete;
+
+		const char* data() const { return ptr; };
+		size_t size() const { return len; };
+
+	private:
+		const char* ptr = nullptr;
+		size_t len = 0;
+#ifdef _WIN32
+		HANDLE file = INVALID_HANDLE_VALUE;
+		HANDLE mapping = nullptr;
+#endif
+	};
+
+#ifdef _WIN32
+	mmap_file::mmap_file(const std::string &fn){
+		file = CreateFileA(fn.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		if (file == INVALID_HANDLE_VALUE) throw std::pair<int, std::string>(72, "Problem reading file '" + fn + "'.");
+		LARGE_INTEGER fsize;
+		GetFileSizeEx(file, &fsize);
+		len = static_cast<size_t>(fsize.QuadPart);
+		if (len == 0) return; //cant map empty files, nothing to see anyway
+		mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (mapping != nullptr) ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+		if (ptr == nullptr){
+			if (mapping != nullptr) CloseHandle(mapping);
+			CloseHandle(file);
+			throw std::pair<int, std::string>(75, "Problem mapping file '" + fn + "'.");
+		}
+	}
+
+	mmap_file::~mmap_file(){
+		if (ptr != nullptr) UnmapViewOfFile(ptr);
+		if (mapping != nullptr) CloseHandle(mapping);
+		if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+	}
+#else
+	mmap_file::mmap_file(const std::string &fn){
+		int fd = open(fn.c_str(), O_RDONLY);
+		if (fd < 0) throw std::pair<int, std::string>(72, "Problem reading file '" + fn + "'.");
+		struct stat st;
+		fstat(fd, &st);
+		len = static_cast<size_t>(st.st_size);
+		if (len == 0){ //cant map empty files, nothing to see anyway
+			close(fd);
+			return;
+		}
+		void* p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+		close(fd); //mapping stays valid
+		if (p == MAP_FAILED) throw std::pair<int, std::string>(75, "Problem mapping file '" + fn + "'.");
+		madvise(p, len, MADV_SEQUENTIAL);
+		ptr = static_cast<const char*>(p);
+	}
+
+	mmap_file::~mmap_file(){
+		if (ptr != nullptr) munmap(const_cast<char*>(ptr), len);
+	}
+#endif
+
+	//XXH64 of n bytes: fast (GBs/s) 64 bit content hash for cache keys, not cryptographic.
+	//chain pieces by passing the previous hash as seed.
+	uint64_t hash64(const void* data, size_t n, uint64_t seed = 0){
+		const uint64_t P1 = 11400714785074694791ULL, P2 = 14029467366897019727ULL, P3 = 1609587929392839161ULL, P4 = 9650029242287828579ULL, P5 = 2870177450012600261ULL;
+		auto rotl = [](uint64_t x, int r){ return (x << r) | (x >> (64 - r)); };
+		auto read64 = [](const unsigned char* p){ uint64_t v; std::memcpy(&v, p, 8); return v; }; //little endian hosts
+		auto read32 = [](const unsigned char* p){ uint32_t v; std::memcpy(&v, p, 4); return v; };
+		auto round = [&](uint64_t acc, uint64_t input){ return rotl(acc + input * P2, 31) * P1; };
+		auto merge = [&](uint64_t acc, uint64_t v){ return (acc ^ round(0, v)) * P1 + P4; };
+
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		const unsigned char* end = p + n;
+		uint64_t h;
+		if (n >= 32){
+			uint64_t v1 = seed + P1 + P2, v2 = seed + P2, v3 = seed, v4 = seed - P1;
+			for (; p + 32 <= end; p += 32){
+				v1 = round(v1, read64(p));
+				v2 = round(v2, read64(p + 8));
+				v3 = round(v3, read64(p + 16));
+				v4 = round(v4, read64(p + 24));
+			}
+			h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+			h = merge(merge(merge(merge(h, v1), v2), v3), v4);
+		}
+		else {
+			h = seed + P5;
+		}
+		h += n;
+		for (; p + 8 <= end; p += 8) h = rotl(h ^ round(0, read64(p)), 27) * P1 + P4;
+		if (p + 4 <= end){
+			h = rotl(h ^ (read32(p) * P1), 23) * P2 + P3;
+			p += 4;
+		}
+		for (; p < end; p++) h = rotl(h ^ (*p * P5), 11) * P1;
+		h ^= h >> 33;
+		h *= P2;
+		h ^= h >> 29;
+		h *= P3;
+		h ^= h >> 32;
+		return h;
+	}
 }
 
 namespace types {
+	//element types an Image can keep natively. FLOAT16 is in-memory only, files get floats.
+	enum class VoxelType { INT16, UINT8, FLOAT32, FLOAT16 };
+
+	struct half { uint16_t bits; }; // IEEE 754 binary16, storage only
+
+	size_t voxel_size(VoxelType type){
+		switch (type){
+		case VoxelType::UINT8: return 1;
+		case VoxelType::INT16: return 2;
+		case VoxelType::FLOAT16: return 2;
+		default: return 4;
+		}
+	}
+
+	template <typename T> VoxelType voxel_type();
+	template <> VoxelType voxel_type<short>() { return VoxelType::INT16; }
+	template <> VoxelType voxel_type<unsigned char>() { return VoxelType::UINT8; }
+	template <> VoxelType voxel_type<float>() { return VoxelType::FLOAT32; }
+	template <> VoxelType voxel_type<half>() { return VoxelType::FLOAT16; }
+
+	float half_to_float(half h){
+		uint32_t sign = uint32_t(h.bits & 0x8000) << 16;
+		uint32_t exp = (h.bits >> 10) & 0x1f;
+		uint32_t mant = h.bits & 0x3ff;
+		if (exp == 0){ //zero or subnormal
+			float f = std::ldexp(float(mant), -24);
+			return sign ? -f : f;
+		}
+		uint32_t bits = (exp == 31) ? (sign | 0x7f800000 | (mant << 13)) : (sign | ((exp + 112) << 23) | (mant << 13));
+		float f;
+		std::memcpy(&f, &bits, sizeof(f));
+		return f;
+	}
+
+	half float_to_half(float f){ //round to nearest even
+		uint32_t x;
+		std::memcpy(&x, &f, sizeof(x));
+		uint16_t sign = (x >> 16) & 0x8000;
+		uint32_t absx = x & 0x7fffffff;
+		if (absx >= 0x7f800000) return { uint16_t(sign | (absx > 0x7f800000 ? 0x7e00 : 0x7c00)) }; //nan, inf
+		if (absx >= 0x477ff000) return { uint16_t(sign | 0x7c00) }; //rounds to inf
+		if (absx < 0x38800000){ //subnormal or zero
+			float a;
+			std::memcpy(&a, &absx, sizeof(a));
+			return { uint16_t(sign | uint32_t(std::nearbyint(a * 16777216.f))) };
+		}
+		uint32_t e = absx - 0x38000000; //rebias exponent
+		return { uint16_t(sign | ((e + 0xfff + ((e >> 13) & 1)) >> 13)) };
+	}
+
+	float to_float(short v){ return v; }
+	float to_float(unsigned char v){ return v; }
+	float to_float(float v){ return v; }
+	float to_float(half v){ return half_to_float(v); }
+
+	//float to voxel type, integers are clamped and rounded to nearest. nan becomes 0 (casting it is undefined).
+	template <typename T> T voxel_cast(float v);
+	template <> short voxel_cast(float v){ if (!(v == v)) return 0; return static_cast<short>(std::nearbyint(std::min(std::max(v, -32768.f), 32767.f))); }
+	template <> unsigned char voxel_cast(float v){ if (!(v == v)) return 0; return static_cast<unsigned char>(std::nearbyint(std::min(std::max(v, 0.f), 255.f))); }
+	template <> float voxel_cast(float v){ return v; }
+	template <> half voxel_cast(float v){ return float_to_half(v); }
+
 	template <typename U,typename T>
 	std::vector<U> reinterpret(const std::vector<T> &in){
 		//change vector type but keep an exact copy of buffer
@@ -251,18 +542,21 @@ namespace types {
 	}
 
 	template <typename T>
-	void swap_endianness(std::vector<char> &in){ //in place
-		if (in.empty()) return; //nothing to do
+	void swap_endianness(char* in, size_t nbytes){ //in place, per element, no copies
 		size_t typesize = sizeof(T);
 		if (typesize == 1) return; //no endianness with onebyte types
+		if (typesize == 2) return simd::swap16(in, in, nbytes / 2);
+		if (typesize == 4) return simd::swap32(in, in, nbytes / 4);
 
-		std::vector<char> out(in);
-		for (size_t i = 0; i < in.size(); i += typesize) {
-			for (size_t j = 0; j < typesize; j++){
-				in[i + j] = out[i + typesize - 1 - j];
-			}
+		for (size_t i = 0; i + typesize <= nbytes; i += typesize) {
+			std::reverse(in + i, in + i + typesize);
 		}
-		return;
+	}
+
+	template <typename T>
+	void swap_endianness(std::vector<char> &in){ //in place
+		if (in.empty()) return; //nothing to do
+		swap_endianness<T>(in.data(), in.size());
 	}
 
 	// lexical_cast, default is fallback
@@ -331,6 +625,53 @@ namespace parse {
 	}
 	int get_index(const std::string &str){ return get_index(str, 1); }
 
+	//FNV-1a of a key. constexpr, so parsers can dispatch with: switch (key_hash(key_prefix(key))) { case key_hash("gantry"): ... }
+	//a key of another name may share a hash, so cases still compare the key itself.
+	constexpr uint64_t key_hash(std::string_view str){
+		uint64_t h = 14695981039346656037ull;
+		for (char c : str){
+			h ^= uint64_t(static_cast<unsigned char>(c));
+			h *= 1099511628211ull;
+		}
+		return h;
+	}
+
+	//key up to the first '[', '.' or '_': "points_element[2][7]" -> "points"
+	std::string_view key_prefix(std::string_view key){
+		return key.substr(0, key.find_first_of("[._"));
+	}
+
+	//key_prefix, but a key that starts with one of bare maps to that name, so cases can keep a plain startswith(key, name) match: "weightxyz" -> "weight"
+	std::string_view key_prefix(std::string_view key, std::initializer_list<std::string_view> bare){
+		for (auto name : bare) if (key.substr(0, name.size()) == name) return name;
+		return key_prefix(key);
+	}
+
+	//get_index(key) and get_index(key, 2) in one scan: "points_element[2][7]" -> {2, 7}. -1 where there is no bracket.
+	std::array<int, 2> key_indices(std::string_view key){
+		std::array<int, 2> ret = { -1, -1 };
+		size_t pos = 1; //as get_index, skip first char
+		for (int &index : ret){
+			size_t open = key.find('[', pos);
+			if (open == std::string_view::npos) break;
+			const char* first = key.data() + open + 1;
+			const char* last = key.data() + key.size();
+			while (first < last && (*first == ' ' || *first == '\t' || *first == '+')) first++;
+			if (std::from_chars(first, last, index).ec != std::errc()) throw std::invalid_argument("key_indices"); //as stoi in get_index
+			pos = open + 1;
+		}
+		return ret;
+	}
+
+	//startswith(lower(str), prefix) without the copy. prefix must be lower case.
+	bool istartswith(std::string_view str, std::string_view prefix){
+		if (str.size() < prefix.size()) return false;
+		for (size_t i = 0; i < prefix.size(); i++){
+			if (std::tolower(static_cast<unsigned char>(str[i])) != prefix[i]) return false;
+		}
+		return true;
+	}
+
 	std::vector<std::pair<std::string, std::string>> parse_dump(const std::vector<std::string> &source) {
 		std::vector<std::pair<std::string, std::string>> ret;
 		for (const auto &item : source){
@@ -354,8 +695,175 @@ namespace parse {
 		return parse_dump(pystring::split(source, "\n"));
 	}
 
+	//a .dump file, mapped and split in one pass, with the same rules as parse_dump(): lines with exactly one '=' give
+	//a stripped key and value (without quotation marks, lines with a quoted key are dropped), any other line is a key with an empty value.
+	//keys and values are views into the mapping, so they are valid as long as the DumpFile is.
+	class DumpFile {
+	public:
+		DumpFile(const std::string &);
+
+		template <typename F> void for_each(F &&) const; //f(std::string_view key, std::string_view value) per line, in file order
+		std::vector<std::pair<std::string_view, std::string_view>> lines() const;
+		uint64_t hash() const { return io::hash64(file->data(), file->size()); }; //of the contents, see io::hash64
+
+	private:
+		std::unique_ptr<io::mmap_file> file;
+
+		static std::string_view strip(std::string_view);
+	};
+
+	DumpFile::DumpFile(const std::string &fn){
+		try {
+			file = std::make_unique<io::mmap_file>(fn);
+		}
+		catch (const std::pair<int, std::string> &) {
+			throw std::pair<int, std::string>(73, "Problem reading file '" + fn + "'."); //as load_dump() always did
+		}
+	}
+
+	std::string_view DumpFile::strip(std::string_view s){
+		//the whitespace of pystring::strip
+		auto space = [](char c){ return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r'; };
+		size_t b = 0, e = s.size();
+		while (b < e && space(s[b])) b++;
+		while (e > b && space(s[e - 1])) e--;
+		return s.substr(b, e - b);
+	}
+
+	template <typename F>
+	void DumpFile::for_each(F &&f) const {
+		const char* p = file->data();
+		const char* end = p + file->size();
+		while (p < end){
+			//one line as std::getline gives it, then the '=' that split() would split on
+			const char* eol = static_cast<const char*>(std::memchr(p, '\n', end - p));
+			if (eol == nullptr) eol = end;
+			std::string_view line(p, eol - p);
+			p = eol + 1;
+			size_t eq = line.find('=');
+			if (eq == std::string_view::npos || line.find('=', eq + 1) != std::string_view::npos){
+				f(line, std::string_view());
+				continue;
+			}
+			std::string_view key = strip(line.substr(0, eq));
+			if (!key.empty() && key.front() == '"') continue;
+			std::string_view value = strip(line.substr(eq + 1));
+			if (!value.empty() && value.front() == '"' && value.size() > 2) value = value.substr(1, value.size() - 2); //strips quotation marks
+			f(key, value);
+		}
+	}
+
+	std::vector<std::pair<std::string_view, std::string_view>> DumpFile::lines() const {
+		std::vector<std::pair<std::string_view, std::string_view>> ret;
+		for_each([&ret](std::string_view key, std::string_view value){ ret.push_back({ key, value }); });
+		return ret;
+	}
+
 	std::vector<std::pair<std::string, std::string>> load_dump(const std::string &dumpfile) {
-		return parse_dump(vect::fromfile<std::string>(dumpfile));
+		std::vector<std::pair<std::string, std::string>> ret;
+		DumpFile(dumpfile).for_each([&ret](std::string_view key, std::string_view value){ ret.emplace_back(key, value); });
+		return ret;
+	}
+
+	//a dump of dotted attribute paths as a tree, each key parsed once. "ControlPointSequence[12].BeamLimitingDevicePositionSequence[2].LeafJawPositions"
+	//is attribute LeafJawPositions of item 2 of BeamLimitingDevicePositionSequence of item 12 of ControlPointSequence of the root.
+	//items of a sequence are in index order and do not depend on each other or on the order of the lines.
+	class DumpTree {
+	public:
+		DumpTree() = default;
+		DumpTree(const std::string &); //dump file
+
+		struct Node {
+			std::string value;
+			std::map<std::string, Node, std::less<>> attributes; //elements without index
+			std::map<std::string, std::vector<Node>, std::less<>> sequences; //elements with index, items by index. missing items are empty nodes.
+
+			const std::string* get(std::string_view) const; //value of an attribute, nullptr when absent
+			const std::vector<Node> &sequence(std::string_view) const; //empty when absent
+			bool empty() const { return value.empty() && attributes.empty() && sequences.empty(); };
+		};
+		typedef std::vector<std::pair<std::string_view, int>> Path; //tag and index per element, -1 for no index
+
+		Node root;
+
+		static Path path(std::string_view); //"A[1].B" -> {("A", 1), ("B", -1)}. an element holds one index, a bracket without a number is part of the tag.
+		const Node* find(const Path &) const; //nullptr when absent
+		void insert(const Path &, std::string_view); //path, value
+
+	private:
+		static constexpr int max_items = 1 << 20; //per sequence, a larger index is a broken file rather than a big one
+	};
+
+	DumpTree::DumpTree(const std::string &fn){
+		DumpFile(fn).for_each([&](std::string_view key, std::string_view value){
+			if (!key.empty()) insert(path(key), value);
+		});
+	}
+
+	DumpTree::Path DumpTree::path(std::string_view key){
+		Path ret;
+		size_t start = 0;
+		while (start <= key.size()){
+			size_t end = std::min(key.find('.', start), key.size());
+			std::string_view element = key.substr(start, end - start);
+			start = end + 1;
+			int index = -1;
+			size_t open = element.find('[', 1); //as get_index, skip first char
+			if (open != std::string_view::npos){
+				auto r = std::from_chars(element.data() + open + 1, element.data() + element.size(), index);
+				if (r.ec == std::errc() && index >= 0 && r.ptr < element.data() + element.size() && *r.ptr == ']') element = element.substr(0, open);
+				else index = -1;
+			}
+			ret.push_back({ element, index });
+		}
+		return ret;
+	}
+
+	const DumpTree::Node* DumpTree::find(const Path &p) const {
+		const Node* node = &root;
+		for (const auto &element : p){
+			if (element.second < 0){
+				auto it = node->attributes.find(element.first);
+				if (it == node->attributes.end()) return nullptr;
+				node = &it->second;
+			}
+			else {
+				auto it = node->sequences.find(element.first);
+				if (it == node->sequences.end() || size_t(element.second) >= it->second.size()) return nullptr;
+				node = &it->second[element.second];
+			}
+		}
+		return node;
+	}
+
+	void DumpTree::insert(const Path &p, std::string_view value){
+		Node* node = &root;
+		for (const auto &element : p){
+			if (element.second < 0){
+				auto it = node->attributes.find(element.first); //no key copy when it exists, which is nearly always
+				if (it == node->attributes.end()) it = node->attributes.emplace(std::string(element.first), Node()).first;
+				node = &it->second;
+			}
+			else {
+				if (element.second >= max_items) throw std::pair<int, std::string>(73, "Index out of range in key '" + std::string(element.first) + "'.");
+				auto it = node->sequences.find(element.first);
+				if (it == node->sequences.end()) it = node->sequences.emplace(std::string(element.first), std::vector<Node>()).first;
+				if (size_t(element.second) >= it->second.size()) it->second.resize(element.second + 1);
+				node = &it->second[element.second];
+			}
+		}
+		node->value = std::string(value);
+	}
+
+	const std::string* DumpTree::Node::get(std::string_view tag) const {
+		auto it = attributes.find(tag);
+		return it == attributes.end() ? nullptr : &it->second.value;
+	}
+
+	const std::vector<DumpTree::Node> &DumpTree::Node::sequence(std::string_view tag) const {
+		static const std::vector<Node> none;
+		auto it = sequences.find(tag);
+		return it == sequences.end() ? none : it->second;
 	}
 
 }
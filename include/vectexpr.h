@@ -0,0 +1,146 @@
+#pragma once
+
+#include <vector>
+#include <cstddef> //size_t
+#include <functional> //std::plus<>, ...
+#include <type_traits>
+#include <assert.h>
+
+/*
+ * Lazy element wise arithmetic on vectors. An expression like
+ *   into(total) += lazy(dose) * weight;
+ *   into(ratio) = lazy(a) / lazy(b);
+ * builds a small tree of types at compile time and runs as one loop over the destination,
+ * without temporaries. Leaves refer to the vectors, so these must outlive the expression.
+ * Scalars are converted to the element type of the other side, so float expressions stay float,
+ * except floating point scalars with integer vectors: lazy(ints) * 0.5 is computed in double, not times int(0.5).
+ */
+
+namespace vect {
+	using std::vector;
+
+	namespace expr {
+		//base of all nodes, so the operators below only match expressions
+		template <typename E>
+		struct Expr {
+			const E &self() const { return static_cast<const E &>(*this); };
+		};
+
+		template <typename T>
+		struct Leaf : Expr<Leaf<T>> {
+			using value_type = T;
+			static constexpr bool broadcast = false;
+			const T* p;
+			size_t n;
+			Leaf(const vector<T> &v) : p(v.data()), n(v.size()){};
+			T operator[](size_t i) const { return p[i]; };
+			size_t size() const { return n; };
+		};
+
+		//broadcast, has no size of its own
+		template <typename T>
+		struct Scalar : Expr<Scalar<T>> {
+			using value_type = T;
+			static constexpr bool broadcast = true;
+			T v;
+			Scalar(T _v) : v(_v){};
+			T operator[](size_t) const { return v; };
+			size_t size() const { return 0; };
+		};
+
+		template <typename Op, typename L, typename R>
+		struct Binary : Expr<Binary<Op, L, R>> {
+			//the type of the leaves, not of Op's result: short + short is int in C++, here it stays short as in the loops this replaces
+			using value_type = std::common_type_t<typename L::value_type, typename R::value_type>;
+			static constexpr bool broadcast = L::broadcast && R::broadcast;
+			L l;
+			R r;
+			Binary(const L &_l, const R &_r) : l(_l), r(_r){
+				assert(L::broadcast || R::broadcast || l.size() == r.size()); //an empty vector is not a scalar
+			};
+			value_type operator[](size_t i) const { return static_cast<value_type>(Op()(l[i], r[i])); };
+			size_t size() const { return L::broadcast ? r.size() : l.size(); };
+		};
+
+		template <typename T>
+		using if_scalar = std::enable_if_t<std::is_arithmetic<T>::value, int>;
+
+		//type a scalar s is kept in next to elements of type T
+		template <typename T, typename S>
+		using scalar_t = std::conditional_t<std::is_integral<T>::value && std::is_floating_point<S>::value, std::common_type_t<T, S>, T>;
+
+#define VECT_EXPR_OPERATOR(OP, FUNCTOR) \
+		template <typename L, typename R> \
+		Binary<FUNCTOR, L, R> operator OP(const Expr<L> &l, const Expr<R> &r){ return { l.self(), r.self() }; } \
+		template <typename L, typename S, if_scalar<S> = 0> \
+		Binary<FUNCTOR, L, Scalar<scalar_t<typename L::value_type, S>>> operator OP(const Expr<L> &l, S s){ return { l.self(), Scalar<scalar_t<typename L::value_type, S>>(s) }; } \
+		template <typename S, typename R, if_scalar<S> = 0> \
+		Binary<FUNCTOR, Scalar<scalar_t<typename R::value_type, S>>, R> operator OP(S s, const Expr<R> &r){ return { Scalar<scalar_t<typename R::value_type, S>>(s), r.self() }; }
+
+		VECT_EXPR_OPERATOR(+, std::plus<>)
+		VECT_EXPR_OPERATOR(-, std::minus<>)
+		VECT_EXPR_OPERATOR(*, std::multiplies<>)
+		VECT_EXPR_OPERATOR(/, std::divides<>)
+#undef VECT_EXPR_OPERATOR
+
+		//destination of an expression, see into()
+		template <typename T>
+		class Into {
+		public:
+			Into(vector<T> &_dst) : dst(_dst){};
+
+			template <typename E> Into &operator=(const Expr<E> &e);
+			template <typename E> Into &operator+=(const Expr<E> &e){ apply(e.self(), [](T &d, T x){ d += x; }); return *this; };
+			template <typename E> Into &operator-=(const Expr<E> &e){ apply(e.self(), [](T &d, T x){ d -= x; }); return *this; };
+			template <typename E> Into &operator*=(const Expr<E> &e){ apply(e.self(), [](T &d, T x){ d *= x; }); return *this; };
+			template <typename E> Into &operator/=(const Expr<E> &e){ apply(e.self(), [](T &d, T x){ d /= x; }); return *this; };
+
+		private:
+			vector<T> &dst;
+
+			//the one loop. dst may appear in e, every element only reads its own index.
+			template <typename E, typename F>
+			void apply(const E &e, F f){
+				assert(E::broadcast || e.size() == dst.size());
+				T* d = dst.data();
+				const size_t n = dst.size();
+				for (size_t i = 0; i < n; i++) f(d[i], static_cast<T>(e[i]));
+			};
+		};
+
+		template <typename T>
+		template <typename E>
+		Into<T> &Into<T>::operator=(const Expr<E> &e){
+			static_assert(!E::broadcast, "a scalar has no size to assign");
+			if (e.self().size() == dst.size()) {
+				apply(e.self(), [](T &d, T x){ d = x; });
+				return *this;
+			}
+			//resizing dst could move it from under a leaf of e, so evaluate next to it
+			vector<T> ret(e.self().size());
+			for (size_t i = 0; i < ret.size(); i++) ret[i] = static_cast<T>(e.self()[i]);
+			dst = std::move(ret);
+			return *this;
+		}
+	}
+
+	//leaf of a lazy expression, refers to v
+	template <typename T>
+	expr::Leaf<T> lazy(const vector<T> &v){
+		return expr::Leaf<T>(v);
+	}
+
+	//evaluate an expression into dst: into(dst) = ..., or accumulate: into(dst) += ...
+	template <typename T>
+	expr::Into<T> into(vector<T> &dst){
+		return expr::Into<T>(dst);
+	}
+
+	//evaluate an expression into a new vector
+	template <typename E>
+	vector<typename E::value_type> eval(const expr::Expr<E> &e){
+		vector<typename E::value_type> ret;
+		into(ret) = e;
+		return ret;
+	}
+}
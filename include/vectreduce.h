@@ -0,0 +1,134 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <utility> //std::pair
+#include <algorithm> //std::min, std::max
+#include <assert.h>
+#include "threads.h" //parallel_for
+
+/*
+ * Reproducible reductions over large vectors (dose, density).
+ * The input is cut in fixed blocks, each summed in double over a fixed number of Kahan compensated lanes,
+ * and the block sums are added pairwise. Blocks may run on any thread, but the tree is fixed by the size alone,
+ * so the result is the same bits for any nr of threads. Do not build with -ffast-math, it removes the compensation.
+ */
+
+namespace vect {
+	using std::vector;
+
+	namespace reduce {
+		constexpr size_t block_size = 1 << 14; //elements per partial
+		constexpr size_t lanes = 8; //independent accumulators per block, lets the compiler vectorize
+		constexpr size_t min_parallel_blocks = 16; //below this threads cost more than they save
+
+		//pairwise sum, the same tree for the same n
+		double pairwise(const double* x, size_t n){
+			if (n == 0) return 0.;
+			if (n == 1) return x[0];
+			size_t h = n / 2;
+			return pairwise(x, h) + pairwise(x + h, n - h);
+		}
+
+		//K sums at once of term(i) -> std::array<double, K>, i in [0, n)
+		template <size_t K, typename F>
+		std::array<double, K> sum_terms(size_t n, F &&term, unsigned int nthreads = 0){
+			size_t nblocks = (n + block_size - 1) / block_size;
+			vector<double> partials(nblocks * K);
+			threads::parallel_for(nblocks, [&](size_t b){
+				size_t first = b * block_size, last = std::min(n, first + block_size);
+				double s[K][lanes] = {}, c[K][lanes] = {};
+				auto add = [&](size_t l, const std::array<double, K> &t){
+					for (size_t k = 0; k < K; k++){
+						double y = t[k] - c[k][l];
+						double u = s[k][l] + y;
+						c[k][l] = (u - s[k][l]) - y;
+						s[k][l] = u;
+					}
+				};
+				size_t i = first;
+				for (; i + lanes <= last; i += lanes){
+					for (size_t l = 0; l < lanes; l++) add(l, term(i + l));
+				}
+				for (size_t l = 0; i < last; i++, l++) add(l, term(i));
+				for (size_t k = 0; k < K; k++){
+					double lane_sums[lanes];
+					for (size_t l = 0; l < lanes; l++) lane_sums[l] = s[k][l] - c[k][l];
+					partials[k * nblocks + b] = pairwise(lane_sums, lanes);
+				}
+			}, nblocks < min_parallel_blocks ? 1 : nthreads);
+
+			std::array<double, K> ret;
+			for (size_t k = 0; k < K; k++) ret[k] = pairwise(partials.data() + k * nblocks, nblocks);
+			return ret;
+		}
+
+		template <typename T>
+		double sum(const vector<T> &v, unsigned int nthreads = 0){
+			const T* p = v.data();
+			return sum_terms<1>(v.size(), [p](size_t i){ return std::array<double, 1>{ double(p[i]) }; }, nthreads)[0];
+		}
+
+		template <typename T, typename U>
+		double dot(const vector<T> &a, const vector<U> &b, unsigned int nthreads = 0){
+			assert(a.size() == b.size());
+			const T* pa = a.data();
+			const U* pb = b.data();
+			return sum_terms<1>(a.size(), [pa, pb](size_t i){ return std::array<double, 1>{ double(pa[i]) * double(pb[i]) }; }, nthreads)[0];
+		}
+
+		//{ sum of v*w, sum of w } in one pass, e.g. for a weighted mean or partial volume masks
+		template <typename T, typename U>
+		std::pair<double, double> weighted_sum(const vector<T> &v, const vector<U> &w, unsigned int nthreads = 0){
+			assert(v.size() == w.size());
+			const T* pv = v.data();
+			const U* pw = w.data();
+			auto r = sum_terms<2>(v.size(), [pv, pw](size_t i){ return std::array<double, 2>{ double(pv[i]) * double(pw[i]), double(pw[i]) }; }, nthreads);
+			return { r[0], r[1] };
+		}
+
+		//{ min, max }, v must not be empty nor hold NaNs
+		template <typename T>
+		std::pair<T, T> minmax(const vector<T> &v, unsigned int nthreads = 0){
+			assert(!v.empty());
+			size_t n = v.size(), nblocks = (n + block_size - 1) / block_size;
+			vector<std::pair<T, T>> partials(nblocks);
+			const T* p = v.data();
+			threads::parallel_for(nblocks, [&](size_t b){
+				size_t first = b * block_size, last = std::min(n, first + block_size);
+				T lo[lanes], hi[lanes];
+				std::fill(lo, lo + lanes, p[first]);
+				std::fill(hi, hi + lanes, p[first]);
+				size_t i = first;
+				for (; i + lanes <= last; i += lanes){
+					for (size_t l = 0; l < lanes; l++){
+						lo[l] = p[i + l] < lo[l] ? p[i + l] : lo[l];
+						hi[l] = p[i + l] > hi[l] ? p[i + l] : hi[l];
+					}
+				}
+				for (; i < last; i++){
+					lo[0] = p[i] < lo[0] ? p[i] : lo[0];
+					hi[0] = p[i] > hi[0] ? p[i] : hi[0];
+				}
+				partials[b] = { lo[0], hi[0] };
+				for (size_t l = 1; l < lanes; l++){
+					partials[b].first = lo[l] < partials[b].first ? lo[l] : partials[b].first;
+					partials[b].second = hi[l] > partials[b].second ? hi[l] : partials[b].second;
+				}
+			}, nblocks < min_parallel_blocks ? 1 : nthreads);
+
+			std::pair<T, T> ret = partials[0];
+			for (const auto &m : partials){
+				ret.first = m.first < ret.first ? m.first : ret.first;
+				ret.second = m.second > ret.second ? m.second : ret.second;
+			}
+			return ret;
+		}
+
+		template <typename T>
+		T min(const vector<T> &v, unsigned int nthreads = 0){ return minmax(v, nthreads).first; }
+
+		template <typename T>
+		T max(const vector<T> &v, unsigned int nthreads = 0){ return minmax(v, nthreads).second; }
+	}
+}